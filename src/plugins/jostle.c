@@ -9,13 +9,85 @@
  * License, version 2 or later.
  *
  * Pushes lines out of the way.
+ *
+ * Usage: Jostle([diameter])\n
+ * Pushes the lines on the current layer out of a circle of the given
+ * diameter around the crosshair.  A trace of several lines passing
+ * through the circle is taken around it as one.  Arcs in the way are
+ * jostled as lines following them; when some of an arc has to move,
+ * the parts of it left in place are made again as arcs.  Afterwards,
+ * new lines that continue straight on from another line are merged
+ * with it, and the number of lines saved that way is reported.
+ *
+ * Usage: Jostle(Selected[, diameter])\n
+ * Does the same around every selected via, using the via size when no
+ * diameter is given.  Vias far enough apart are planned on separate
+ * threads, so link with -pthread.
+ *
+ * Usage: Jostle([Selected,] AllLayers[, diameter])\n
+ * Usage: Jostle([Selected,] Groups, 1:3[, diameter])\n
+ * Jostles on every copper layer, or on the copper layers of the listed
+ * layer groups, instead of just the current layer.  The layers are
+ * planned at the same time and undone as one step.
+ *
+ * Usage: Jostle([Selected,] Relax[, diameter])\n
+ * Instead of taking the traces in the way around the circle one by
+ * one, bends every trace near it at once until all keep their
+ * clearance from the circle and from each other, then straightens the
+ * result out to 45 degree lines.  Corners move along with the lines;
+ * only the ends of traces, and where they branch or meet a pin, pad,
+ * via or arc, stay put.  Arcs are left alone.  If the lines made do
+ * not all clear the circle, each other and whatever else is on the
+ * board, says how much clearance is still missing.
+ *
+ * Usage: JostlePreview([On|Off|Toggle][, diameter])\n
+ * Shows what Jostle() would do at the crosshair, planned in the
+ * background as the crosshair moves.  Jostle() with the same diameter
+ * then applies the plan shown without planning again.
+ *
+ * Usage: JostleDrag([Start|Stop][, diameter])\n
+ * From Start to Stop, pushes lines out of the corridor the crosshair
+ * sweeps, a strip at a time as it moves.  Bind Start and Stop to the
+ * press and release of a key.
+ *
+ * Usage: JostleStats([Clear])\n
+ * Reports, for each of the last jostles, the work done and the time
+ * spent planning, applying and merging.
+ *
+ * Usage: JostleBench(traces, pitch, Orthogonal|Diagonal, width[:width...], points[, diameter[, file]])\n
+ * Benchmark on an empty board: lays down a bus of parallel traces
+ * and jostles it at each point of a grid, starting from a fresh bus
+ * every time.  Refuses to run if the current layer has any lines, as
+ * they would be destroyed along with the bus.  Appends comma separated
+ * results to the file, or writes them to stdout.  For example:\n
+ * echo "JostleBench(64, 8mil, Diagonal, 4mil:6mil, 5, 20mil, bench.csv)" | pcb --gui batch
+ *
+ * Usage: FindViaSpot(diameter[, radius])\n
+ * Moves the crosshair to the nearest grid point, within the radius
+ * (ten diameters by default), where a via of the given diameter, with
+ * the clearance new vias get, would clear every line, arc, pin, pad and
+ * via on the copper layers, so that it can go there without jostling
+ * anything.
+ *
+ * Usage: JostleBudget([vertices])\n
+ * Sets the most vertices the brush may grow to before it is simplified
+ * into a bigger, plainer shape (256 by default, at least 16), or
+ * reports the current budget.
+ *
+ * Usage: JostleReplay([Draw | File, name])\n
+ * Only when compiled with JOSTLE_RECORD defined: shows the last steps
+ * of the algorithm (brushes, slices and bypasses) over the board one at
+ * a time without blocking, or writes them to a file.
  */
 
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "config.h"
 #include "global.h"
@@ -31,9 +103,11 @@
 #include "remove.h"
 #include "error.h"
 #include "set.h"
+#include "draw.h"
 #include "pcb-printf.h"
 
-//#define DEBUG_POLYAREA
+/* Keep the last steps of each jostle for JostleReplay(). */
+//#define JOSTLE_RECORD
 
 double vect_dist2 (Vector v1, Vector v2);
 #define Vcpy2(r,a)              {(r)[0] = (a)[0]; (r)[1] = (a)[1];}
@@ -70,52 +144,113 @@ const char *dirnames[] =
 
 #define ARG(n) (argc > (n) ? argv[n] : 0)
 
-static const char jostle_syntax[] = "Jostle(diameter)";
+static const char jostle_syntax[] =
+  "Jostle([Selected,] [Relax,] [AllLayers | Groups, list,] [diameter])";
+
+static const char jostle_budget_syntax[] = "JostleBudget([vertices])";
+
+/*!
+ * \brief Most vertices the brush may have before it is simplified.
+ */
+static int jostle_brush_budget = 256;
+
+#define JOSTLE_MIN_BUDGET 16
+
+/* PBO_UNITE, PBO_ISECT, PBO_SUB and PBO_XOR */
+#define JOSTLE_BOOLEAN_OPS 4
+
+#define JOSTLE_HISTORY 16
+
+static const char jostle_stats_syntax[] = "JostleStats([Clear])";
+
+static const char jostle_bench_syntax[] =
+  "JostleBench(traces, pitch, Orthogonal|Diagonal, width[:width...], points[, diameter[, file]])";
+
+static const char find_via_spot_syntax[] = "FindViaSpot(diameter[, radius])";
+
+/*!
+ * \brief What a recorded step shows.
+ */
+enum
+{
+  JOSTLE_STEP_BRUSH,
+  JOSTLE_STEP_SLICE,
+  JOSTLE_STEP_BYPASS,
+  JOSTLE_STEP_NOTE
+};
+
+#ifdef JOSTLE_RECORD
+
+#define JOSTLE_RECORD_STEPS 1024
+
+static const char *jostle_step_names[] = {"brush", "slice", "bypass", "note"};
+
+static const char *jostle_step_colors[] = {"#00ff00", "#ff00ff", "#00ffff", NULL};
+
+/*!
+ * \brief One step of the algorithm, kept for JostleReplay().
+ */
+struct jostle_step
+{
+  int kind;
+  POLYAREA *poly;
+    /*!< a copy of the polygon, or NULL for a note. */
+  char *note;
+};
+
+/*!
+ * \brief The last JOSTLE_RECORD_STEPS steps, from any thread.
+ */
+static struct
+{
+  struct jostle_step step[JOSTLE_RECORD_STEPS];
+  int next;
+  int count;
+  pthread_mutex_t lock;
+  hidval timer;
+  int replay;
+    /*!< steps left to draw. */
+} jostle_recorder = {.lock = PTHREAD_MUTEX_INITIALIZER};
 
-/* DEBUG */
 static void
-DebugPOLYAREA (POLYAREA *s, char *color)
+jostle_record_step (int kind, POLYAREA *poly, char *note)
 {
-  int *x, *y, n, i = 0;
-  PLINE *pl;
-  VNODE *v;
-  POLYAREA *p;
+  struct jostle_step *s;
 
-#ifndef DEBUG_POLYAREA
-  return;
-#endif
-  p = s;
-  do
-  {
-    for (pl = p->contours; pl; pl = pl->next)
-    {
-      n = pl->Count;
-      x = (int *) malloc (n * sizeof (int));
-      y = (int *) malloc (n * sizeof (int));
-      for (v = &pl->head; i < n; v = v->next)
-      {
-        x[i] = v->point[0];
-        y[i++] = v->point[1];
-      }
-      if (1)
-      {
-        gui->graphics->set_color (Output.fgGC, color ? color : PCB->ConnectedColor);
-        gui->graphics->set_line_width (Output.fgGC, 1);
-        for (i = 0; i < n - 1; i++)
-        {
-          gui->graphics->draw_line (Output.fgGC, x[i], y[i], x[i + 1], y[i + 1]);
-          //  gui->fill_circle (Output.fgGC, x[i], y[i], 30);
-        }
-        gui->graphics->draw_line (Output.fgGC, x[n - 1], y[n - 1], x[0], y[0]);
-      }
-      free (x);
-      free (y);
-    }
-  } while ((p = p->f) != s);
-  hid_action ("Busy");
-  sleep (3);
+  pthread_mutex_lock (&jostle_recorder.lock);
+  s = &jostle_recorder.step[jostle_recorder.next];
+  if (s->poly)
+    poly_Free (&s->poly);
+  g_free (s->note);
+  s->kind = kind;
+  s->poly = poly;
+  s->note = note;
+  jostle_recorder.next = (jostle_recorder.next + 1) % JOSTLE_RECORD_STEPS;
+  if (jostle_recorder.count < JOSTLE_RECORD_STEPS)
+    jostle_recorder.count++;
+  pthread_mutex_unlock (&jostle_recorder.lock);
 }
 
+static void
+jostle_record (int kind, POLYAREA *poly)
+{
+  POLYAREA *copy = NULL;
+
+  if (poly && poly_M_Copy0 (&copy, poly))
+    jostle_record_step (kind, copy, NULL);
+}
+
+#define JOSTLE_RECORD_POLY(kind, poly) jostle_record ((kind), (poly))
+#define JOSTLE_LOG(...) \
+  jostle_record_step (JOSTLE_STEP_NOTE, NULL, pcb_g_strdup_printf (__VA_ARGS__))
+
+#else
+
+#define JOSTLE_RECORD_POLY(kind, poly) do { } while (0)
+#define JOSTLE_LOG(...) do { } while (0)
+
+#endif
+
 
 #if 0
 enum
@@ -214,443 +349,5609 @@ POLYAREA_boundingBox (POLYAREA *a)
 }
 
 /*!
- * Given a polygon and a side of it (a direction north/northeast/etc),
- * find a line tangent to that side, offset by clearance, and return it
- * as a pair of vectors PQ.\n
+ * \brief Extremes of a shape in eight directions: a discrete oriented
+ * polytope (k-DOP) with k = 8.
+ *
+ * Axis 0 is x, 1 is y, 2 is x+y and 3 is x-y.  Kept in doubles because
+ * sums of coordinates can overflow a Coord.
+ */
+struct kdop
+{
+  double min[4];
+  double max[4];
+};
+
+enum
+{
+  KDOP_X,
+  KDOP_Y,
+  KDOP_SUM,
+  KDOP_DIFF
+};
+
+static void
+kdop_init (struct kdop *k)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+  {
+    k->min[i] = DBL_MAX;
+    k->max[i] = -DBL_MAX;
+  }
+}
+
+static void
+kdop_add (struct kdop *k, double x, double y)
+{
+  double v[4];
+  int i;
+
+  v[KDOP_X] = x;
+  v[KDOP_Y] = y;
+  v[KDOP_SUM] = x + y;
+  v[KDOP_DIFF] = x - y;
+  for (i = 0; i < 4; i++)
+  {
+    MAKEMIN (k->min[i], v[i]);
+    MAKEMAX (k->max[i], v[i]);
+  }
+}
+
+/*!
+ * \brief Grow \p k to also cover \p other.
+ */
+static void
+kdop_merge (struct kdop *k, const struct kdop *other)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+  {
+    MAKEMIN (k->min[i], other->min[i]);
+    MAKEMAX (k->max[i], other->max[i]);
+  }
+}
+
+/*!
+ * \brief Add the vertices of one contour to \p k.
+ */
+static void
+kdop_add_PLINE (struct kdop *k, PLINE *pl)
+{
+  VNODE *v = &pl->head;
+
+  do
+  {
+    kdop_add (k, v->point[0], v->point[1]);
+  } while ((v = v->next) != &pl->head);
+}
+
+/*!
+ * \brief The k-DOP of one contour, e.g. the outline of a single piece
+ * of a POLYAREA ring.
+ */
+static void
+kdop_of_PLINE (struct kdop *k, PLINE *pl)
+{
+  kdop_init (k);
+  kdop_add_PLINE (k, pl);
+}
+
+/*!
+ * \brief The k-DOP of all outlines of a POLYAREA, in one pass over the
+ * vertices.  Holes can't stick out, so they are skipped.
+ */
+static void
+kdop_of_POLYAREA (struct kdop *k, POLYAREA *a)
+{
+  POLYAREA *n = a;
+
+  kdop_init (k);
+  do
+  {
+    kdop_add_PLINE (k, n->contours);
+  } while ((n = n->f) != a);
+}
+
+/*!
+ * Given the extremes of a polygon and a side of it (a direction
+ * north/northeast/etc), find a line tangent to that side, offset by
+ * clearance, and return it as a pair of vectors PQ.\n
  * Make it long so it will intersect everything in the area.
  */
 static void
-POLYAREA_findXmostLine (POLYAREA *a, int side, Vector p, Vector q, int clearance)
+kdop_findXmostLine (const struct kdop *k, int side, Vector p, Vector q, int clearance)
 {
+  Coord xmin = k->min[KDOP_X], xmax = k->max[KDOP_X];
+  Coord ymin = k->min[KDOP_Y], ymax = k->max[KDOP_Y];
+  int extra = xmax - xmin + ymax - ymin;
+
   p[0] = p[1] = 0;
   q[0] = q[1] = 0;
-  int extra = a->contours->xmax - a->contours->xmin
-    + a->contours->ymax - a->contours->ymin;
   switch (side)
   {
     case NORTH:
-      p[1] = q[1] = a->contours->ymin - clearance;
-      p[0] = a->contours->xmin - extra;
-      q[0] = a->contours->xmax + extra;
+      p[1] = q[1] = ymin - clearance;
+      p[0] = xmin - extra;
+      q[0] = xmax + extra;
       break;
     case SOUTH:
-      p[1] = q[1] = a->contours->ymax + clearance;
-      p[0] = a->contours->xmin - extra;
-      q[0] = a->contours->xmax + extra;
+      p[1] = q[1] = ymax + clearance;
+      p[0] = xmin - extra;
+      q[0] = xmax + extra;
       break;
     case EAST:
-      p[0] = q[0] = a->contours->xmax + clearance;
-      p[1] = a->contours->ymin - extra;
-      q[1] = a->contours->ymax + extra;
+      p[0] = q[0] = xmax + clearance;
+      p[1] = ymin - extra;
+      q[1] = ymax + extra;
       break;
     case WEST:
-      p[0] = q[0] = a->contours->xmin - clearance;
-      p[1] = a->contours->ymin - extra;
-      q[1] = a->contours->ymax + extra;
+      p[0] = q[0] = xmin - clearance;
+      p[1] = ymin - extra;
+      q[1] = ymax + extra;
       break;
     default: /* diagonal case */
     {
-      int kx, ky, minmax, dq, ckx, cky;
-      Coord mm[2] = {MAX_COORD, -MAX_COORD};
-      Vector mmp[2];
-      VNODE *v;
+      int dq;
+      Coord c, mid;
 
+      /* clearance in the right direction, at 45 degrees */
+      c = 2 * (int) (clearance * 0.707123); /* = cos(45) = sqrt(2)/2 */
+      mid = (xmin + xmax) / 2;
       switch (side)
       {
-        case NORTHWEST:
-          kx = 1; /* new_x = kx * x + ky * y */
-          ky = 1;
+        case NORTHWEST: /* x + y = least - 2c */
           dq = -1; /* extend line in +x, dq*y */
-          ckx = cky = -1; /* clear line in ckx*clear, cky*clear */
-          minmax = 0; /* min or max */
+          p[0] = mid;
+          p[1] = (Coord) k->min[KDOP_SUM] - c - mid;
           break;
-        case SOUTHWEST:
-          kx = 1;
-          ky = -1;
+        case SOUTHWEST: /* x - y = least - 2c */
           dq = 1;
-          ckx = -1;
-          cky = 1;
-          minmax = 0;
+          p[0] = mid;
+          p[1] = mid - ((Coord) k->min[KDOP_DIFF] - c);
           break;
-        case NORTHEAST:
-          kx = 1;
-          ky = -1;
+        case NORTHEAST: /* x - y = most + 2c */
           dq = 1;
-          ckx = 1;
-          cky = -1;
-          minmax = 1;
+          p[0] = mid;
+          p[1] = mid - ((Coord) k->max[KDOP_DIFF] + c);
           break;
-        case SOUTHEAST:
-          kx = ky = 1;
+        case SOUTHEAST: /* x + y = most + 2c */
           dq = -1;
-          ckx = cky = 1;
-          minmax = 1;
+          p[0] = mid;
+          p[1] = (Coord) k->max[KDOP_SUM] + c - mid;
           break;
         default:
           Message("bjj: aiee, what side?");
           return;
       }
-    v = &a->contours->head;
-    do
-    {
-      int test = kx * v->point[0] + ky * v->point[1];
-      if (test < mm[0])
-      {
-        mm[0] = test;
-        mmp[0][0] = v->point[0];
-        mmp[0][1] = v->point[1];
-      }
-      if (test > mm[1])
-      {
-        mm[1] = test;
-        mmp[1][0] = v->point[0];
-        mmp[1][1] = v->point[1];
-      }
-    } while ((v = v->next) != &a->contours->head);
-    Vcpy2 (p, mmp[minmax]);
-    /* add clearance in the right direction */
-    clearance *= 0.707123; /* = cos(45) = sqrt(2)/2 */
-    p[0] += ckx * clearance;
-    p[1] += cky * clearance;
-    /* now create a tangent line to that point */
-    Vcpy2 (q, p);
-    p[0] += -extra;
-    p[1] += -extra * dq;
-    q[0] += extra;
-    q[1] += extra * dq;
+      /* now create a tangent line through that point */
+      Vcpy2 (q, p);
+      p[0] += -extra;
+      p[1] += -extra * dq;
+      q[0] += extra;
+      q[1] += extra * dq;
     }
   }
 }
 
 /*!
- * Given a 'side' from the NORTH/SOUTH/etc enum, rotate it by n.
+ * \brief A set of pointers, hashed on their address.
+ *
+ * Open addressing with linear probing; removed slots are marked with a
+ * tombstone so probe chains stay intact.
  */
-static int
-rotateSide (int side, int n)
+struct ptrset
 {
-  return (side + n + 8) % 8;
+  void **slot;
+  int size;
+    /*!< always a power of two, or 0 before the first insert. */
+  int used;
+    /*!< live entries plus tombstones. */
+};
+
+static char ptrset_tombstone;
+
+static unsigned int
+ptrset_hash (const void *p)
+{
+  unsigned long h = (unsigned long) p;
+
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return (unsigned int) h;
 }
 
 /*!
- * Wrapper for CreateNewLineOnLayer that takes vectors and deals with Undo
+ * \brief Return the slot holding \p p, or the empty slot where it
+ * would go.
  */
-static LineType *
-CreateVectorLineOnLayer (LayerType *layer, Vector a, Vector b, int thickness, int clearance, FlagType flags)
+static void **
+ptrset_lookup (struct ptrset *s, const void *p)
 {
-  LineType *line;
+  unsigned int i, mask = s->size - 1;
+  void **tomb = NULL;
 
-  line = CreateNewLineOnLayer (layer, a[0], a[1], b[0], b[1], thickness, clearance, flags);
-  if (line)
+  for (i = ptrset_hash (p) & mask; s->slot[i] != NULL; i = (i + 1) & mask)
   {
-    AddObjectToCreateUndoList (LINE_TYPE, layer, line, line);
+    if (s->slot[i] == p)
+      return &s->slot[i];
+    if (s->slot[i] == &ptrset_tombstone && tomb == NULL)
+      tomb = &s->slot[i];
   }
-  return line;
+  return tomb ? tomb : &s->slot[i];
 }
 
-static LineType *
-MakeBypassLine (LayerType *layer, Vector a, Vector b, LineType *orig, POLYAREA **expandp)
+static bool
+ptrset_contains (struct ptrset *s, const void *p)
 {
-  LineType *line;
+  return s->size && *ptrset_lookup (s, p) == p;
+}
+
+static void
+ptrset_add (struct ptrset *s, void *p)
+{
+  void **slot;
 
-  line = CreateVectorLineOnLayer (layer, a, b,
-    orig->Thickness, orig->Clearance, orig->Flags);
-  if (line && expandp)
+  if ((s->used + 1) * 2 > s->size)
   {
-    POLYAREA *p = LinePoly (line, line->Thickness + line->Clearance);
-    poly_Boolean_free (*expandp, p, expandp, PBO_UNITE);
+    void **old = s->slot;
+    int i, oldsize = s->size;
+
+    s->size = oldsize ? oldsize * 2 : 64;
+    s->slot = (void **) calloc (s->size, sizeof (void *));
+    s->used = 0;
+    for (i = 0; i < oldsize; i++)
+    {
+      if (old[i] != NULL && old[i] != &ptrset_tombstone)
+      {
+        *ptrset_lookup (s, old[i]) = old[i];
+        s->used++;
+      }
+    }
+    free (old);
   }
-  return line;
+  slot = ptrset_lookup (s, p);
+  if (*slot == p)
+    return;
+  if (*slot == NULL)
+    s->used++;
+  *slot = p;
 }
 
-/*!
- * Given a 'brush' that's pushing things out of the way (possibly already
- * cut down to just the part relevant to our line) and a line that
- * intersects it on some layer, find the 45/90 lines required to go around
- * the brush on the named side.  Create them and remove the original.
- *
- * Imagine side = north:
- * <pre>
-                 /      \
-            ----b##FLAT##c----
-               Q          P
-   lA-ORIG####a            d####ORIG-lB
-             /              \
- * </pre>
- * First find the extended three lines that go around the brush.
- * Then intersect them with each other and the original to find
- * points a, b, c, d.  Finally connect the dots and remove the
- * old straight line.
- */
-static int
-MakeBypassingLines (POLYAREA *brush, LayerType *layer, LineType *line, int side, POLYAREA **expandp)
+static void
+ptrset_remove (struct ptrset *s, const void *p)
 {
-  Vector pA, pB, flatA, flatB, qA, qB;
-  Vector lA, lB;
-  Vector a, b, c, d, junk;
-  int hits;
+  void **slot;
 
-  SET_FLAG (DRCFLAG, line); /* will cause sublines to inherit */
-  lA[0] = line->Point1.X;
-  lA[1] = line->Point1.Y;
-  lB[0] = line->Point2.X;
-  lB[1] = line->Point2.Y;
+  if (!s->size)
+    return;
+  slot = ptrset_lookup (s, p);
+  if (*slot == p)
+    *slot = &ptrset_tombstone;
+}
 
-  POLYAREA_findXmostLine (brush, side, flatA, flatB, line->Thickness / 2);
-  POLYAREA_findXmostLine (brush, rotateSide(side, 1), pA, pB, line->Thickness / 2);
-  POLYAREA_findXmostLine (brush, rotateSide(side, -1), qA, qB, line->Thickness / 2);
-  hits = vect_inters2 (lA, lB, qA, qB, a, junk) + 
-    vect_inters2 (qA, qB, flatA, flatB, b, junk) +
-    vect_inters2 (pA, pB, flatA, flatB, c, junk) +
-    vect_inters2 (lA, lB, pA, pB, d, junk);
-  if (hits != 4)
-  {
-    return 0;
-  }
-  /* flip the line endpoints to match up with a/b */
-  if (vect_dist2 (lA, d) < vect_dist2 (lA, a))
-  {
-    Vswp2 (lA, lB);
-  }
-  MakeBypassLine (layer, lA, a, line, NULL);
-  MakeBypassLine (layer, a, b, line, expandp);
-  MakeBypassLine (layer, b, c, line, expandp);
-  MakeBypassLine (layer, c, d, line, expandp);
-  MakeBypassLine (layer, d, lB, line, NULL);
-  RemoveLine (layer, line);
-  return 1;
+static void
+ptrset_free (struct ptrset *s)
+{
+  free (s->slot);
+  s->slot = NULL;
+  s->size = s->used = 0;
 }
 
-struct info
+/*!
+ * \brief A polygon made from a line at some width, kept for the rest of
+ * one jostle() call.
+ */
+struct polycache_entry
 {
-  BoxType box;
-  POLYAREA *brush;
-  LayerType *layer;
-  POLYAREA *smallest;
-    /*!< after cutting brush with line, the smallest chunk, which we
-     * will go around on 'side'.
-     */
   LineType *line;
-  int side;
-  double centroid;
-    /*!< smallest difference between slices of brush after cutting with
-     * line, trying to find the line closest to the centroid to process
-     * first
-     */
+  Coord width;
+  POLYAREA *poly;
+  struct polycache_entry *next;
 };
 
 /*!
- * Process lines that intersect our 'brush'.
+ * \brief Line polygons by line and width.
+ *
+ * All widths of one line hash to the same bucket, so dropping a line
+ * only has to look at one chain.
  */
-static int
-jostle_callback (const BoxType *targ, void *private)
+struct polycache
 {
-  LineType *line = (LineType *) targ;
-  struct info *info = private;
-  POLYAREA *lp, *copy, *tmp, *n, *smallest = NULL;
-  Vector p;
-  int inside = 0, side, r;
-  double small, big;
-  int nocentroid = 0;
+  struct polycache_entry **bucket;
+  int size;
+  int count;
+};
+
+static struct polycache_entry **
+polycache_bucket (struct polycache *c, const LineType *line)
+{
+  return &c->bucket[ptrset_hash (line) & (c->size - 1)];
+}
+
+/*!
+ * \brief Find or make the polygon of \p line at \p width.
+ *
+ * The cache keeps ownership: callers must not free the result or hand
+ * it to poly_Boolean_free().
+ */
+static POLYAREA *
+polycache_get (struct polycache *c, LineType *line, Coord width)
+{
+  struct polycache_entry *e, **b;
 
-  if (TEST_FLAG (DRCFLAG, line))
+  if (c->size == 0)
   {
-    return 0;
+    c->size = 256;
+    c->bucket = (struct polycache_entry **) calloc (c->size,
+      sizeof (struct polycache_entry *));
   }
-  fprintf (stderr, "hit! %p\n", line);
-  p[0] = line->Point1.X;
-  p[1] = line->Point1.Y;
-  if (poly_InsideContour (info->brush->contours, p))
+  b = polycache_bucket (c, line);
+  for (e = *b; e; e = e->next)
   {
-    pcb_fprintf (stderr, "\tinside1 %ms,%ms\n", p[0],p[1]);
-    inside++;
+    if (e->line == line && e->width == width)
+      return e->poly;
   }
-  p[0] = line->Point2.X;
-  p[1] = line->Point2.Y;
-  if (poly_InsideContour (info->brush->contours, p))
+  e = (struct polycache_entry *) malloc (sizeof (struct polycache_entry));
+  e->line = line;
+  e->width = width;
+  e->poly = LinePoly (line, width);
+  e->next = *b;
+  *b = e;
+  c->count++;
+  return e->poly;
+}
+
+/*!
+ * \brief Forget every polygon made from \p line.
+ */
+static void
+polycache_invalidate (struct polycache *c, const LineType *line)
+{
+  struct polycache_entry *e, **prev;
+
+  if (c->size == 0)
+    return;
+  prev = polycache_bucket (c, line);
+  while ((e = *prev) != NULL)
   {
-    pcb_fprintf (stderr, "\tinside2 %ms,%ms\n", p[0],p[1]);
-    inside++;
+    if (e->line == line)
+    {
+      *prev = e->next;
+      poly_Free (&e->poly);
+      free (e);
+      c->count--;
+    }
+    else
+      prev = &e->next;
   }
-  lp = LinePoly (line, line->Thickness);
-  if (!Touching (lp, info->brush))
-  {
+}
+
+static void
+polycache_free (struct polycache *c)
+{
+  struct polycache_entry *e, *next;
+  int i;
+
+  for (i = 0; i < c->size; i++)
+  {
+    for (e = c->bucket[i]; e; e = next)
+    {
+      next = e->next;
+      poly_Free (&e->poly);
+      free (e);
+    }
+  }
+  free (c->bucket);
+  c->bucket = NULL;
+  c->size = c->count = 0;
+}
+
+/*!
+ * \brief What the jostle engine did, for JostleStats().
+ */
+struct jostle_stats
+{
+  int iterations;
+    /*!< rounds of the worklist loop. */
+  int search_hits;
+    /*!< objects found by r_search. */
+  int touching_tests;
+  int prefilter_tests, prefilter_rejects;
+    /*!< lines looked at, and lines found not to touch the brush without
+     * building their polygon.
+     */
+  int booleans[JOSTLE_BOOLEAN_OPS];
+    /*!< poly_Boolean and poly_Boolean_free calls, by operation. */
+  int peak_vertices;
+    /*!< most vertices the brush had. */
+  int brush_rounds;
+  long vertices;
+    /*!< rounds of the worklist loop with a brush, and its vertices
+     * summed over them.
+     */
+  int created, removed, merged;
+    /*!< lines put on the board, objects taken off, and lines saved by
+     * merging.
+     */
+  double relax_left;
+    /*!< how much too close relaxing left lines, at worst. */
+  double plan_time, apply_time, merge_time;
+    /*!< wall time of each phase, in seconds. */
+};
+
+static void
+jostle_stats_add (struct jostle_stats *to, const struct jostle_stats *from)
+{
+  int i;
+
+  to->iterations += from->iterations;
+  to->search_hits += from->search_hits;
+  to->touching_tests += from->touching_tests;
+  to->prefilter_tests += from->prefilter_tests;
+  to->prefilter_rejects += from->prefilter_rejects;
+  for (i = 0; i < JOSTLE_BOOLEAN_OPS; i++)
+    to->booleans[i] += from->booleans[i];
+  MAKEMAX (to->peak_vertices, from->peak_vertices);
+  to->brush_rounds += from->brush_rounds;
+  to->vertices += from->vertices;
+  to->created += from->created;
+  to->removed += from->removed;
+  to->merged += from->merged;
+  MAKEMAX (to->relax_left, from->relax_left);
+  to->plan_time += from->plan_time;
+  to->apply_time += from->apply_time;
+  to->merge_time += from->merge_time;
+}
+
+static double
+jostle_now (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*!
+ * \brief The last JOSTLE_HISTORY calls, for JostleStats().
+ */
+static struct
+{
+  struct jostle_stats call[JOSTLE_HISTORY];
+  int calls;
+    /*!< calls so far, the newest is call[(calls - 1) % JOSTLE_HISTORY]. */
+} jostle_history;
+
+static void
+jostle_stats_record (const struct jostle_stats *stats)
+{
+  jostle_history.call[jostle_history.calls++ % JOSTLE_HISTORY] = *stats;
+}
+
+/*!
+ * \brief The lines ending at one point.
+ */
+struct endpoint_entry
+{
+  Coord x, y;
+  LineType **lines;
+  int lines_n, lines_max;
+  struct endpoint_entry *next;
+};
+
+/*!
+ * \brief Line adjacency by endpoint, for following a trace made of
+ * several lines.
+ *
+ * Points are only looked up in the r-tree the first time they are
+ * asked about, and lines added to the plan later are noted in the points
+ * already known.  Lines that have been removed since are left in; the
+ * caller skips them.
+ */
+struct endpoint_map
+{
+  struct endpoint_entry **bucket;
+  int size;
+};
+
+/*!
+ * \brief What jostling would do to one layer: lines and arcs to remove
+ * and to create.
+ *
+ * Planning never changes the board, so it can run on a worker thread.
+ * New lines and arcs are private copies until the plan is applied.  A later
+ * brush in the same plan may jostle them again, in which case they are
+ * marked gone and never created at all.
+ */
+struct jostle_plan
+{
+  LayerType *layer;
+  LineType **lines;
+    /*!< planned new lines, owned by the plan. */
+  int lines_n, lines_max;
+  LineType **removed;
+    /*!< lines on the board to remove. */
+  int removed_n, removed_max;
+  ArcType **arcs;
+    /*!< planned new arcs, the parts of arcs left, owned by the plan. */
+  int arcs_n, arcs_max;
+  ArcType **removed_arcs;
+    /*!< arcs on the board to remove, partly bypassed. */
+  int removed_arcs_n, removed_arcs_max;
+  struct ptrset own;
+    /*!< the lines in 'lines' and the arcs in 'arcs'. */
+  struct ptrset gone;
+    /*!< lines and arcs, on the board or planned, that have been
+     * bypassed, in part for arcs.
+     */
+  BoxType looked;
+    /*!< covers everything planning looked at. */
+  BoxType touched;
+    /*!< covers everything the plan would change. */
+  volatile int *cancel;
+    /*!< when set, and it becomes non-zero, planning stops early. */
+  LineType **created;
+    /*!< board lines made by jostle_apply_plan(). */
+  int created_n, created_max;
+  struct endpoint_map ends;
+    /*!< lines by endpoint, kept for every brush of the plan. */
+  struct jostle_stats stats;
+};
+
+static void
+box_empty (BoxType *box)
+{
+  box->X1 = box->Y1 = MAX_COORD;
+  box->X2 = box->Y2 = -MAX_COORD;
+}
+
+static void
+box_grow (BoxType *box, const BoxType *other)
+{
+  MAKEMIN (box->X1, other->X1);
+  MAKEMIN (box->Y1, other->Y1);
+  MAKEMAX (box->X2, other->X2);
+  MAKEMAX (box->Y2, other->Y2);
+}
+
+static bool
+box_overlap (const BoxType *a, const BoxType *b)
+{
+  return a->X1 < b->X2 && b->X1 < a->X2 && a->Y1 < b->Y2 && b->Y1 < a->Y2;
+}
+
+/*!
+ * \brief Make room for one more element in a growing array.
+ */
+static void *
+grow_array (void *array, int n, int *max, size_t size)
+{
+  if (n < *max)
+    return array;
+  *max = *max ? *max * 2 : 64;
+  return realloc (array, *max * size);
+}
+
+static struct endpoint_entry **
+endpoint_map_bucket (struct endpoint_map *m, Coord x, Coord y)
+{
+  unsigned long h = (unsigned long) x * 31 + (unsigned long) y;
+
+  h ^= h >> 16;
+  return &m->bucket[(h * 2654435761UL) & (m->size - 1)];
+}
+
+/*!
+ * \brief Find the entry for (x, y), or NULL if it is not known yet.
+ */
+static struct endpoint_entry *
+endpoint_map_find (struct endpoint_map *m, Coord x, Coord y)
+{
+  struct endpoint_entry *e;
+
+  if (m->size == 0)
+    return NULL;
+  for (e = *endpoint_map_bucket (m, x, y); e; e = e->next)
+  {
+    if (e->x == x && e->y == y)
+      return e;
+  }
+  return NULL;
+}
+
+static struct endpoint_entry *
+endpoint_map_insert (struct endpoint_map *m, Coord x, Coord y)
+{
+  struct endpoint_entry *e, **b;
+
+  if (m->size == 0)
+  {
+    m->size = 256;
+    m->bucket = (struct endpoint_entry **) calloc (m->size,
+      sizeof (struct endpoint_entry *));
+  }
+  b = endpoint_map_bucket (m, x, y);
+  e = (struct endpoint_entry *) calloc (1, sizeof (struct endpoint_entry));
+  e->x = x;
+  e->y = y;
+  e->next = *b;
+  *b = e;
+  return e;
+}
+
+static void
+endpoint_entry_add (struct endpoint_entry *e, LineType *line)
+{
+  e->lines = (LineType **) grow_array (e->lines, e->lines_n, &e->lines_max,
+    sizeof (LineType *));
+  e->lines[e->lines_n++] = line;
+}
+
+/*!
+ * \brief Note a new line in the points already known.
+ */
+static void
+endpoint_map_note (struct endpoint_map *m, LineType *line)
+{
+  struct endpoint_entry *e;
+
+  if ((e = endpoint_map_find (m, line->Point1.X, line->Point1.Y)) != NULL)
+    endpoint_entry_add (e, line);
+  if ((e = endpoint_map_find (m, line->Point2.X, line->Point2.Y)) != NULL)
+    endpoint_entry_add (e, line);
+}
+
+static void
+endpoint_map_free (struct endpoint_map *m)
+{
+  struct endpoint_entry *e, *next;
+  int i;
+
+  for (i = 0; i < m->size; i++)
+  {
+    for (e = m->bucket[i]; e; e = next)
+    {
+      next = e->next;
+      free (e->lines);
+      free (e);
+    }
+  }
+  free (m->bucket);
+  m->bucket = NULL;
+  m->size = 0;
+}
+
+static void
+jostle_plan_init (struct jostle_plan *plan, LayerType *layer)
+{
+  memset (plan, 0, sizeof (*plan));
+  plan->layer = layer;
+  box_empty (&plan->looked);
+  box_empty (&plan->touched);
+}
+
+static void
+jostle_plan_free (struct jostle_plan *plan)
+{
+  int i;
+
+  for (i = 0; i < plan->lines_n; i++)
+    free (plan->lines[i]);
+  free (plan->lines);
+  for (i = 0; i < plan->arcs_n; i++)
+    free (plan->arcs[i]);
+  free (plan->arcs);
+  free (plan->removed);
+  free (plan->removed_arcs);
+  free (plan->created);
+  ptrset_free (&plan->own);
+  ptrset_free (&plan->gone);
+  endpoint_map_free (&plan->ends);
+  jostle_plan_init (plan, plan->layer);
+}
+
+/*!
+ * \brief Add a new line to \p plan, which takes ownership of it.
+ */
+static void
+jostle_plan_add (struct jostle_plan *plan, LineType *line)
+{
+  plan->lines = (LineType **) grow_array (plan->lines, plan->lines_n,
+    &plan->lines_max, sizeof (LineType *));
+  plan->lines[plan->lines_n++] = line;
+  ptrset_add (&plan->own, line);
+  box_grow (&plan->touched, &line->BoundingBox);
+}
+
+/*!
+ * \brief Plan the removal of a line, on the board or planned.
+ */
+static void
+jostle_plan_remove (struct jostle_plan *plan, LineType *line)
+{
+  ptrset_add (&plan->gone, line);
+  if (ptrset_contains (&plan->own, line))
+  {
+    /* only planned so far, just don't create it */
+    return;
+  }
+  plan->removed = (LineType **) grow_array (plan->removed, plan->removed_n,
+    &plan->removed_max, sizeof (LineType *));
+  plan->removed[plan->removed_n++] = line;
+  box_grow (&plan->touched, &line->BoundingBox);
+}
+
+struct arccache_entry;
+
+/*!
+ * \brief One of the lines an arc is followed by.
+ */
+struct arc_seg
+{
+  LineType line;
+    /*!< must come first. */
+  struct arccache_entry *entry;
+    /*!< the arc it is part of. */
+};
+
+/*!
+ * \brief An arc as a chain of lines, kept for the rest of one brush.
+ */
+struct arccache_entry
+{
+  ArcType *arc;
+  struct arc_seg *segs;
+  int segs_n;
+  struct arccache_entry *next;
+};
+
+struct arccache
+{
+  struct arccache_entry **bucket;
+  int size;
+};
+
+#define ARC_MAX_SEGMENTS 128
+
+/*!
+ * \brief How closely lines follow an arc when the lines relaxing made
+ * are checked against it.
+ */
+#define JOSTLE_ARC_TOLERANCE MIL_TO_COORD (0.01)
+
+/*!
+ * \brief Find or make the lines following \p arc to within
+ * \p tolerance.
+ *
+ * The lines are like the arc in width, clearance and flags, and end
+ * exactly on the arc's end points, so whatever connects to the arc
+ * connects to them too.
+ */
+static struct arccache_entry *
+arccache_get (struct arccache *c, ArcType *arc, double tolerance)
+{
+  struct arccache_entry *e, **b;
+  double r, step, a, delta;
+  PointType p, q;
+  int i, n;
+
+  if (c->size == 0)
+  {
+    c->size = 64;
+    c->bucket = (struct arccache_entry **) calloc (c->size,
+      sizeof (struct arccache_entry *));
+  }
+  b = &c->bucket[ptrset_hash (arc) & (c->size - 1)];
+  for (e = *b; e; e = e->next)
+  {
+    if (e->arc == arc)
+      return e;
+  }
+  /* each chord may stray 'tolerance' from the arc */
+  r = MAX (arc->Width, arc->Height);
+  delta = fabs ((double) arc->Delta) * M_PI / 180.0;
+  step = tolerance < r ? 2 * acos (1 - tolerance / r) : M_PI / 2;
+  n = (int) ceil (delta / step);
+  n = MAX (1, MIN (n, ARC_MAX_SEGMENTS));
+  e = (struct arccache_entry *) malloc (sizeof (struct arccache_entry));
+  e->arc = arc;
+  e->segs = (struct arc_seg *) calloc (n, sizeof (struct arc_seg));
+  e->segs_n = n;
+  p = arc->Point1;
+  for (i = 0; i < n; i++)
+  {
+    if (i == n - 1)
+    {
+      q = arc->Point2;
+    }
+    else
+    {
+      a = (arc->StartAngle + (double) arc->Delta * (i + 1) / n) * M_PI / 180.0;
+      q.X = arc->X - arc->Width * cos (a);
+      q.Y = arc->Y + arc->Height * sin (a);
+    }
+    e->segs[i].line.Point1 = p;
+    e->segs[i].line.Point2 = q;
+    e->segs[i].line.Thickness = arc->Thickness;
+    e->segs[i].line.Clearance = arc->Clearance;
+    e->segs[i].line.Flags = arc->Flags;
+    CLEAR_FLAG (DRCFLAG, &e->segs[i].line);
+    SetLineBoundingBox (&e->segs[i].line);
+    e->segs[i].entry = e;
+    p = q;
+  }
+  e->next = *b;
+  *b = e;
+  return e;
+}
+
+static void
+arccache_free (struct arccache *c)
+{
+  struct arccache_entry *e, *next;
+  int i;
+
+  for (i = 0; i < c->size; i++)
+  {
+    for (e = c->bucket[i]; e; e = next)
+    {
+      next = e->next;
+      free (e->segs);
+      free (e);
+    }
+  }
+  free (c->bucket);
+  c->bucket = NULL;
+  c->size = 0;
+}
+
+/*!
+ * \brief A trace of several lines passing through the brush, bypassed
+ * as one straight line from where it goes in to where it comes out.
+ */
+struct jostle_chain
+{
+  LineType line;
+    /*!< stands in for the whole trace; must come first. */
+  LineType **lines;
+    /*!< the lines making up the trace. */
+  int lines_n;
+  int round;
+    /*!< the last round of the worklist loop that looked at it. */
+  bool stale;
+    /*!< the brush has grown over an end, or the trace changed. */
+};
+
+#define JOSTLE_MAX_CHAIN 64
+
+struct info
+{
+  BoxType box;
+  POLYAREA *brush;
+  LayerType *layer;
+  struct jostle_plan *plan;
+    /*!< where bypasses go instead of onto the board. */
+  struct kdop brush_kdop;
+    /*!< extremes of the brush, grown along with it. */
+  struct kdop smallest;
+    /*!< after cutting brush with line, the extremes of the smallest
+     * chunk, which we will go around on 'side'.
+     */
+  LineType *line;
+  int side;
+  double centroid;
+    /*!< smallest difference between slices of brush after cutting with
+     * line, trying to find the line closest to the centroid to process
+     * first
+     */
+  int brush_vertices;
+    /*!< vertex count of the brush, kept within jostle_brush_budget. */
+  bool brush_convex;
+    /*!< the brush is a single convex contour, so lines can be cut
+     * through it in closed form.
+     */
+  LineType **work;
+    /*!< worklist: lines found near the brush which still have to be
+     * looked at again after the next bypass.
+     */
+  int work_n, work_max;
+  struct ptrset queued;
+    /*!< lines currently on the worklist. */
+  struct polycache polys;
+    /*!< line polygons made for this brush. */
+  struct arccache arcs;
+    /*!< arcs as lines, for this brush. */
+  double tolerance;
+    /*!< how far the lines standing for an arc may stray from it while
+     * looking for what is in the way.
+     */
+  struct ptrset arc_lines;
+    /*!< lines standing for arcs; see jostle_replace_arc(). */
+  struct ptrset arc_gone;
+    /*!< arc lines bypassed, or replaced by closer ones. */
+  struct arccache_entry **arcs_hit;
+  int arcs_hit_n, arcs_hit_max;
+    /*!< arcs with lines bypassed by the last bypass. */
+  struct endpoint_map arc_ends;
+    /*!< the lines standing for arcs, by endpoint; the plan's map holds
+     * the rest.
+     */
+  struct jostle_chain **chains;
+  int chains_n, chains_max;
+    /*!< traces followed through the brush, freed with it. */
+  struct ptrset chain_lines;
+    /*!< the lines standing in for 'chains'. */
+  struct ptrset chained;
+    /*!< lines that are part of one of 'chains'. */
+  int round;
+    /*!< rounds of the worklist loop so far. */
+  struct ptrset visited;
+    /*!< lines that can never be jostled during this call, e.g. because
+     * an endpoint is inside the brush.  The brush only grows, so that
+     * does not change.
+     */
+};
+
+/*!
+ * Results of jostle_callback(), telling the worklist what to do with
+ * the line.
+ */
+enum
+{
+  JOSTLE_DROP,
+    /*!< not touching the brush (yet); take it off the worklist until a
+     * later bypass grows the brush into it.
+     */
+  JOSTLE_REJECT,
+    /*!< never going to be jostled in this call. */
+  JOSTLE_KEEP,
+    /*!< touching, but some other line is a better choice for now. */
+  JOSTLE_BEST
+    /*!< the best line to go around so far. */
+};
+
+static int
+jostle_boolean (struct info *info, POLYAREA *a, POLYAREA *b, POLYAREA **res,
+  int op)
+{
+  info->plan->stats.booleans[op]++;
+  return poly_Boolean (a, b, res, op);
+}
+
+static int
+jostle_boolean_free (struct info *info, POLYAREA *a, POLYAREA *b,
+  POLYAREA **res, int op)
+{
+  info->plan->stats.booleans[op]++;
+  return poly_Boolean_free (a, b, res, op);
+}
+
+static bool
+jostle_touching (struct info *info, POLYAREA *a, POLYAREA *b)
+{
+  info->plan->stats.touching_tests++;
+  return Touching (a, b);
+}
+
+/*!
+ * Given a 'side' from the NORTH/SOUTH/etc enum, rotate it by n.
+ */
+static int
+rotateSide (int side, int n)
+{
+  return (side + n + 8) % 8;
+}
+
+/*!
+ * Wrapper for CreateNewLineOnLayer that takes vectors and deals with Undo
+ */
+static LineType *
+CreateVectorLineOnLayer (LayerType *layer, Vector a, Vector b, int thickness, int clearance, FlagType flags)
+{
+  LineType *line;
+
+  line = CreateNewLineOnLayer (layer, a[0], a[1], b[0], b[1], thickness, clearance, flags);
+  if (line)
+  {
+    AddObjectToCreateUndoList (LINE_TYPE, layer, line, line);
+  }
+  return line;
+}
+
+/*!
+ * Add a new line to the plan, and to the endpoint map.
+ */
+static void
+jostle_plan_line (struct info *info, LineType *line)
+{
+  jostle_plan_add (info->plan, line);
+  endpoint_map_note (&info->plan->ends, line);
+}
+
+/*!
+ * \brief r_search callback putting lines found near the brush on the
+ * worklist.
+ */
+static int
+jostle_enqueue_callback (const BoxType *targ, void *private)
+{
+  LineType *line = (LineType *) targ;
+  struct info *info = private;
+
+  info->plan->stats.search_hits++;
+  if (TEST_FLAG (DRCFLAG, line)
+    || ptrset_contains (&info->plan->gone, line)
+    || ptrset_contains (&info->arc_gone, line)
+    || ptrset_contains (&info->visited, line)
+    || ptrset_contains (&info->queued, line))
+  {
+    return 0;
+  }
+  if (info->work_n == info->work_max)
+  {
+    info->work_max = info->work_max ? info->work_max * 2 : 64;
+    info->work = (LineType **) realloc (info->work,
+      info->work_max * sizeof (LineType *));
+  }
+  info->work[info->work_n++] = line;
+  ptrset_add (&info->queued, line);
+  return 1;
+}
+
+/*!
+ * \brief The lines standing for \p arc while looking for what is in the
+ * way of the brush.
+ */
+static struct arccache_entry *
+jostle_arc (struct info *info, ArcType *arc)
+{
+  struct arccache_entry *e;
+  int i;
+
+  e = arccache_get (&info->arcs, arc, info->tolerance);
+  if (!ptrset_contains (&info->arc_lines, &e->segs[0].line))
+  {
+    for (i = 0; i < e->segs_n; i++)
+      ptrset_add (&info->arc_lines, &e->segs[i].line);
+  }
+  return e;
+}
+
+/*!
+ * \brief r_search callback putting the lines standing for arcs near the
+ * brush on the worklist, like any other.
+ *
+ * The lines and their polygons are made once and reused while the brush
+ * grows.  The arc itself stays unless one of them is bypassed.
+ */
+static int
+jostle_arc_callback (const BoxType *targ, void *private)
+{
+  ArcType *arc = (ArcType *) targ;
+  struct info *info = private;
+  struct arccache_entry *e;
+  int i, r = 0;
+
+  info->plan->stats.search_hits++;
+  if (ptrset_contains (&info->plan->gone, arc))
+  {
+    return 0;
+  }
+  e = jostle_arc (info, arc);
+  for (i = 0; i < e->segs_n; i++)
+    r |= jostle_enqueue_callback (&e->segs[i].line.BoundingBox, info);
+  return r;
+}
+
+/*!
+ * \brief Plan a new arc for the part of \p e's arc that its lines
+ * \p from up to \p to follow, and queue it for the brush.
+ */
+static void
+jostle_plan_arc (struct info *info, struct arccache_entry *e, int from,
+  int to)
+{
+  struct jostle_plan *plan = info->plan;
+  ArcType *arc;
+
+  arc = (ArcType *) malloc (sizeof (ArcType));
+  *arc = *e->arc;
+  arc->StartAngle = e->arc->StartAngle
+    + (double) e->arc->Delta * from / e->segs_n;
+  arc->Delta = (double) e->arc->Delta * (to - from) / e->segs_n;
+  SetArcBoundingBox (arc);
+  /* end exactly where the lines did, as the bypass joins them there */
+  arc->Point1 = e->segs[from].line.Point1;
+  arc->Point2 = e->segs[to - 1].line.Point2;
+  plan->arcs = (ArcType **) grow_array (plan->arcs, plan->arcs_n,
+    &plan->arcs_max, sizeof (ArcType *));
+  plan->arcs[plan->arcs_n++] = arc;
+  ptrset_add (&plan->own, arc);
+  box_grow (&plan->touched, &arc->BoundingBox);
+  jostle_arc_callback (&arc->BoundingBox, info);
+}
+
+/*!
+ * \brief Replace an arc that had some of its lines bypassed.
+ *
+ * Its lines only follow it closely enough to tell what is in the way;
+ * their chords cut inside the arc and could come closer to something
+ * than it did.  So each stretch of the arc the bypass left is planned
+ * as an arc of its own, ending where the bypass joins it.
+ */
+static void
+jostle_replace_arc (struct info *info, struct arccache_entry *e)
+{
+  struct jostle_plan *plan = info->plan;
+  ArcType *arc = e->arc;
+  int i, j;
+
+  if (!ptrset_contains (&plan->own, arc))
+  {
+    plan->removed_arcs = (ArcType **) grow_array (plan->removed_arcs,
+      plan->removed_arcs_n, &plan->removed_arcs_max, sizeof (ArcType *));
+    plan->removed_arcs[plan->removed_arcs_n++] = arc;
+    box_grow (&plan->touched, &arc->BoundingBox);
+  }
+  for (i = 0; i < e->segs_n; i = j)
+  {
+    if (ptrset_contains (&info->arc_gone, &e->segs[i].line))
+    {
+      j = i + 1; /* bypassed */
+      continue;
+    }
+    for (j = i; j < e->segs_n
+      && !ptrset_contains (&info->arc_gone, &e->segs[j].line); j++)
+      ptrset_add (&info->arc_gone, &e->segs[j].line);
+    jostle_plan_arc (info, e, i, j);
+  }
+}
+
+/*!
+ * Add a line like \p orig from a to b to the plan.
+ */
+static LineType *
+MakeBypassLine (struct info *info, Vector a, Vector b, LineType *orig, POLYAREA **expandp)
+{
+  LineType *line;
+
+  line = (LineType *) calloc (1, sizeof (LineType));
+  line->Point1.X = a[0];
+  line->Point1.Y = a[1];
+  line->Point2.X = b[0];
+  line->Point2.Y = b[1];
+  line->Thickness = orig->Thickness;
+  line->Clearance = orig->Clearance;
+  line->Flags = orig->Flags;
+  SET_FLAG (DRCFLAG, line); /* not to be jostled again by this brush */
+  SetLineBoundingBox (line);
+  jostle_plan_line (info, line);
+  if (expandp)
+  {
+    POLYAREA *p;
+
+    poly_M_Copy0 (&p, polycache_get (&info->polys, line,
+      line->Thickness + line->Clearance));
+    jostle_boolean_free (info, *expandp, p, expandp, PBO_UNITE);
+  }
+  return line;
+}
+
+/*!
+ * Plan the removal of a line, forgetting any polygons made from it.
+ */
+static void
+RemoveJostledLine (struct info *info, LineType *line)
+{
+  struct jostle_plan *plan = info->plan;
+
+  if (ptrset_contains (&info->chain_lines, line))
+  {
+    struct jostle_chain *chain = (struct jostle_chain *) line;
+    int i;
+
+    for (i = 0; i < chain->lines_n; i++)
+      RemoveJostledLine (info, chain->lines[i]);
+    return;
+  }
+  polycache_invalidate (&info->polys, line);
+  if (ptrset_contains (&info->arc_lines, line))
+  {
+    struct arccache_entry *e = ((struct arc_seg *) line)->entry;
+
+    /* the arc goes once the bypass is done */
+    if (!ptrset_contains (&plan->gone, e->arc))
+    {
+      ptrset_add (&plan->gone, e->arc);
+      info->arcs_hit = (struct arccache_entry **) grow_array (info->arcs_hit,
+        info->arcs_hit_n, &info->arcs_hit_max,
+        sizeof (struct arccache_entry *));
+      info->arcs_hit[info->arcs_hit_n++] = e;
+    }
+    ptrset_add (&info->arc_gone, line);
+    return;
+  }
+  jostle_plan_remove (plan, line);
+}
+
+/*!
+ * Carry out a plan on the board, with undo.
+ */
+static void
+jostle_apply_plan (struct jostle_plan *plan)
+{
+  LineType *line;
+  ArcType *arc;
+  Vector a, b;
+  int i, arcs = 0;
+
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    line = plan->lines[i];
+    if (ptrset_contains (&plan->gone, line))
+      continue;
+    a[0] = line->Point1.X;
+    a[1] = line->Point1.Y;
+    b[0] = line->Point2.X;
+    b[1] = line->Point2.Y;
+    line = CreateVectorLineOnLayer (plan->layer, a, b,
+      line->Thickness, line->Clearance, line->Flags);
+    if (line == NULL)
+      continue;
+    plan->created = (LineType **) grow_array (plan->created, plan->created_n,
+      &plan->created_max, sizeof (LineType *));
+    plan->created[plan->created_n++] = line;
+    if (plan->layer->On)
+      DrawLine (plan->layer, line);
+  }
+  for (i = 0; i < plan->arcs_n; i++)
+  {
+    arc = plan->arcs[i];
+    if (ptrset_contains (&plan->gone, arc))
+      continue;
+    arc = CreateNewArcOnLayer (plan->layer, arc->X, arc->Y, arc->Width,
+      arc->Height, arc->StartAngle, arc->Delta, arc->Thickness,
+      arc->Clearance, arc->Flags);
+    if (arc == NULL)
+      continue;
+    AddObjectToCreateUndoList (ARC_TYPE, plan->layer, arc, arc);
+    arcs++;
+    if (plan->layer->On)
+      DrawArc (plan->layer, arc);
+  }
+  for (i = 0; i < plan->removed_n; i++)
+  {
+    RemoveLine (plan->layer, plan->removed[i]);
+  }
+  for (i = 0; i < plan->removed_arcs_n; i++)
+  {
+    RemoveArc (plan->layer, plan->removed_arcs[i]);
+  }
+  plan->stats.created += plan->created_n + arcs;
+  plan->stats.removed += plan->removed_n + plan->removed_arcs_n;
+}
+
+/*!
+ * \brief Lines ending at one point, for jostle_coalesce().
+ */
+struct coalesce_point
+{
+  Coord x, y;
+  LineType *line[3];
+  int n;
+};
+
+static int
+coalesce_point_callback (const BoxType *targ, void *private)
+{
+  struct coalesce_point *p = private;
+  LineType *line = (LineType *) targ;
+
+  if ((line->Point1.X == p->x && line->Point1.Y == p->y)
+    || (line->Point2.X == p->x && line->Point2.Y == p->y))
+  {
+    if (p->n < 3)
+      p->line[p->n] = line;
+    p->n++;
+  }
+  return p->n < 3;
+}
+
+/*!
+ * \brief Check whether two lines can be one: alike, and continuing each
+ * other straight on from their common point (x, y).
+ */
+static bool
+coalesce_pair (LineType *a, LineType *b, Coord x, Coord y, PointType *far_a,
+  PointType *far_b)
+{
+  double ax, ay, bx, by;
+
+  if (a->Thickness != b->Thickness || a->Clearance != b->Clearance
+    || (a->Flags.f & ~(DRCFLAG | SELECTEDFLAG))
+      != (b->Flags.f & ~(DRCFLAG | SELECTEDFLAG))
+    || memcmp (a->Flags.t, b->Flags.t, sizeof (a->Flags.t)) != 0)
+  {
+    return false;
+  }
+  *far_a = (a->Point1.X == x && a->Point1.Y == y) ? a->Point2 : a->Point1;
+  *far_b = (b->Point1.X == x && b->Point1.Y == y) ? b->Point2 : b->Point1;
+  ax = far_a->X - x;
+  ay = far_a->Y - y;
+  bx = far_b->X - x;
+  by = far_b->Y - y;
+  /* collinear, and on opposite sides of the common point */
+  return ax * by - ay * bx == 0 && ax * bx + ay * by < 0;
+}
+
+/*!
+ * \brief Merge the lines jostling made with the lines they continue
+ * straight on from, so repeated jostles don't leave traces in ever more
+ * pieces.
+ *
+ * Only points where exactly two lines meet are merged across.  The
+ * array of lines (\p workp, \p work_np, \p work_maxp) is updated to hold
+ * what became of them.
+ *
+ * \return the number of lines removed from the board.
+ */
+static int
+jostle_coalesce (LayerType *layer, LineType ***workp, int *work_np,
+  int *work_maxp)
+{
+  LineType **work = *workp, *line, *other, *merged;
+  int work_n = *work_np, work_max = *work_maxp, removed = 0, i, end;
+  struct ptrset dead;
+  struct coalesce_point p;
+  PointType far_a, far_b;
+  Vector a, b;
+
+  memset (&dead, 0, sizeof (dead));
+  for (i = 0; i < work_n; i++)
+  {
+    line = work[i];
+    if (ptrset_contains (&dead, line))
+      continue;
+    for (end = 0; end < 2; end++)
+    {
+      memset (&p, 0, sizeof (p));
+      p.x = end ? line->Point2.X : line->Point1.X;
+      p.y = end ? line->Point2.Y : line->Point1.Y;
+      {
+        BoxType box;
+
+        box.X1 = p.x;
+        box.Y1 = p.y;
+        box.X2 = p.x + 1;
+        box.Y2 = p.y + 1;
+        r_search (layer->line_tree, &box, NULL, coalesce_point_callback, &p);
+      }
+      if (p.n != 2)
+        continue;
+      other = p.line[0] == line ? p.line[1] : p.line[0];
+      if (!coalesce_pair (line, other, p.x, p.y, &far_a, &far_b))
+        continue;
+      a[0] = far_a.X;
+      a[1] = far_a.Y;
+      b[0] = far_b.X;
+      b[1] = far_b.Y;
+      merged = CreateVectorLineOnLayer (layer, a, b, line->Thickness,
+        line->Clearance, line->Flags);
+      if (merged == NULL)
+        continue;
+      /* the memory of a removed line may have been reused */
+      ptrset_remove (&dead, merged);
+      ptrset_add (&dead, line);
+      ptrset_add (&dead, other);
+      RemoveLine (layer, line);
+      RemoveLine (layer, other);
+      removed++;
+      if (layer->On)
+        DrawLine (layer, merged);
+      /* it may line up with yet another line */
+      work = (LineType **) grow_array (work, work_n, &work_max,
+        sizeof (LineType *));
+      work[work_n++] = merged;
+      break;
+    }
+  }
+  for (i = end = 0; i < work_n; i++)
+  {
+    if (!ptrset_contains (&dead, work[i]))
+      work[end++] = work[i];
+  }
+  *workp = work;
+  *work_np = end;
+  *work_maxp = work_max;
+  ptrset_free (&dead);
+  return removed;
+}
+
+/*!
+ * \brief Merge the lines the last jostle made on \p layer, those with
+ * DRCFLAG, see jostle_coalesce().
+ */
+static int
+jostle_coalesce_layer (LayerType *layer)
+{
+  LineType **work = NULL;
+  int work_n = 0, work_max = 0, removed;
+
+  LINE_LOOP (layer);
+  {
+    if (TEST_FLAG (DRCFLAG, line))
+    {
+      work = (LineType **) grow_array (work, work_n, &work_max,
+        sizeof (LineType *));
+      work[work_n++] = line;
+    }
+  }
+  END_LOOP;
+  removed = jostle_coalesce (layer, &work, &work_n, &work_max);
+  free (work);
+  return removed;
+}
+
+/*!
+ * Given the extremes of a 'brush' that's pushing things out of the way
+ * (possibly already cut down to just the part relevant to our line) and
+ * a line that intersects it on some layer, find the 45/90 lines required to go around
+ * the brush on the named side.  Plan to create them and remove the original.
+ *
+ * Imagine side = north:
+ * <pre>
+                 /      \
+            ----b##FLAT##c----
+               Q          P
+   lA-ORIG####a            d####ORIG-lB
+             /              \
+ * </pre>
+ * First find the extended three lines that go around the brush.
+ * Then intersect them with each other and the original to find
+ * points a, b, c, d.  Finally connect the dots and remove the
+ * old straight line.
+ */
+static int
+MakeBypassingLines (struct info *info, const struct kdop *brush, LineType *line, int side, POLYAREA **expandp)
+{
+  Vector pA, pB, flatA, flatB, qA, qB;
+  Vector lA, lB;
+  Vector a, b, c, d, junk;
+  int hits;
+
+  lA[0] = line->Point1.X;
+  lA[1] = line->Point1.Y;
+  lB[0] = line->Point2.X;
+  lB[1] = line->Point2.Y;
+
+  kdop_findXmostLine (brush, side, flatA, flatB, line->Thickness / 2);
+  kdop_findXmostLine (brush, rotateSide(side, 1), pA, pB, line->Thickness / 2);
+  kdop_findXmostLine (brush, rotateSide(side, -1), qA, qB, line->Thickness / 2);
+  hits = vect_inters2 (lA, lB, qA, qB, a, junk) + 
+    vect_inters2 (qA, qB, flatA, flatB, b, junk) +
+    vect_inters2 (pA, pB, flatA, flatB, c, junk) +
+    vect_inters2 (lA, lB, pA, pB, d, junk);
+  if (hits != 4)
+  {
+    return 0;
+  }
+  /* flip the line endpoints to match up with a/b */
+  if (vect_dist2 (lA, d) < vect_dist2 (lA, a))
+  {
+    Vswp2 (lA, lB);
+  }
+  MakeBypassLine (info, lA, a, line, NULL);
+  MakeBypassLine (info, a, b, line, expandp);
+  MakeBypassLine (info, b, c, line, expandp);
+  MakeBypassLine (info, c, d, line, expandp);
+  MakeBypassLine (info, d, lB, line, NULL);
+  RemoveJostledLine (info, line);
+  return 1;
+}
+
+/*!
+ * \brief Check whether a brush is a single convex contour without holes.
+ */
+static bool
+POLYAREA_isConvex (POLYAREA *a)
+{
+  PLINE *pl = a->contours;
+  VNODE *v;
+  double cross;
+  int sign = 0;
+
+  if (a->f != a || pl->next != NULL)
+  {
+    return false;
+  }
+  if (pl->is_round)
+  {
+    return true;
+  }
+  v = &pl->head;
+  do
+  {
+    cross = (double) (v->next->point[0] - v->point[0])
+      * (v->next->next->point[1] - v->next->point[1])
+      - (double) (v->next->point[1] - v->point[1])
+      * (v->next->next->point[0] - v->next->point[0]);
+    if (cross != 0)
+    {
+      if (sign == 0)
+        sign = cross > 0 ? 1 : -1;
+      else if ((cross > 0) != (sign > 0))
+        return false;
+    }
+  } while ((v = v->next) != &pl->head);
+  return true;
+}
+
+/*!
+ * \brief One side of a convex brush cut by the infinite line through a
+ * LineType.
+ */
+struct slice
+{
+  double area;
+  double tmin, tmax;
+    /*!< extent of the chord, as parameters along the line (0 at
+     * Point1, 1 at Point2).
+     */
+  double ox, oy, lx, ly, fx, fy;
+    /*!< origin, last and first emitted points for the shoelace sum. */
+  int n;
+  struct kdop k;
+};
+
+/*!
+ * \brief Which side of the line through \p line the point is on, scaled
+ * by the line length.
+ */
+static double
+line_side (LineType *line, double x, double y)
+{
+  return (double) (line->Point2.X - line->Point1.X) * (y - line->Point1.Y)
+    - (double) (line->Point2.Y - line->Point1.Y) * (x - line->Point1.X);
+}
+
+static void
+slice_emit (struct slice *s, LineType *line, double x, double y, bool on_line)
+{
+  if (on_line)
+  {
+    double dx = line->Point2.X - line->Point1.X;
+    double dy = line->Point2.Y - line->Point1.Y;
+    double t = ((x - line->Point1.X) * dx + (y - line->Point1.Y) * dy)
+      / (dx * dx + dy * dy);
+
+    MAKEMIN (s->tmin, t);
+    MAKEMAX (s->tmax, t);
+  }
+  kdop_add (&s->k, x, y);
+  /* shoelace relative to the first point keeps the products small */
+  x -= s->ox;
+  y -= s->oy;
+  if (s->n++ == 0)
+  {
+    s->fx = x;
+    s->fy = y;
+  }
+  else
+  {
+    s->area += s->lx * y - s->ly * x;
+  }
+  s->lx = x;
+  s->ly = y;
+}
+
+/*!
+ * \brief Clip a convex contour to the half plane where line_side() has
+ * the sign \p sign.
+ *
+ * Works out area and extremes of what is left without
+ * allocating anything.
+ */
+static void
+convex_half (PLINE *pl, LineType *line, int sign, struct slice *s)
+{
+  VNODE *v = &pl->head;
+  double f0, f1, t;
+
+  memset (s, 0, sizeof (*s));
+  s->tmin = DBL_MAX;
+  s->tmax = -DBL_MAX;
+  s->ox = v->point[0];
+  s->oy = v->point[1];
+  kdop_init (&s->k);
+  do
+  {
+    f0 = sign * line_side (line, v->point[0], v->point[1]);
+    f1 = sign * line_side (line, v->next->point[0], v->next->point[1]);
+    if (f0 >= 0)
+    {
+      slice_emit (s, line, v->point[0], v->point[1], f0 == 0);
+    }
+    if ((f0 > 0 && f1 < 0) || (f0 < 0 && f1 > 0))
+    {
+      t = f0 / (f0 - f1);
+      slice_emit (s, line,
+        v->point[0] + t * (v->next->point[0] - v->point[0]),
+        v->point[1] + t * (v->next->point[1] - v->point[1]), true);
+    }
+  } while ((v = v->next) != &pl->head);
+  if (s->n > 0)
+  {
+    s->area += s->lx * s->fy - s->ly * s->fx;
+  }
+  s->area = fabs (s->area) / 2;
+}
+
+/*!
+ * \brief Area of the part of a circle of radius \p r cut off by a chord
+ * at distance \p h from the centre.
+ */
+static double
+circle_segment_area (double r, double h)
+{
+  if (h >= r)
+    return 0;
+  return r * r * acos (h / r) - h * sqrt (r * r - h * h);
+}
+
+/*!
+ * \brief Slice a convex brush with a line in closed form.
+ *
+ * Returns false if the line does not cut right through the brush (it
+ * only grazes it, or stops short of it), in which case the caller has
+ * to fall back to boolean operations.  Otherwise \p small_out describes
+ * the smaller half.
+ */
+static bool
+jostle_slice_convex (struct info *info, LineType *line,
+  struct slice *small_out, double *small, double *big)
+{
+  PLINE *pl = info->brush->contours;
+  struct slice pos, neg;
+  int sign;
+
+  if (line->Point1.X == line->Point2.X && line->Point1.Y == line->Point2.Y)
+  {
+    return false;
+  }
+  convex_half (pl, line, 1, &pos);
+  if (pos.tmin > pos.tmax || pos.tmin == pos.tmax
+    || (pos.tmin + pos.tmax) / 2 < 0 || (pos.tmin + pos.tmax) / 2 > 1)
+  {
+    /* misses or only touches a vertex: it doesn't slice */
+    return false;
+  }
+  if (pl->is_round)
+  {
+    /* exact chord areas of the circle the brush stands for */
+    double len = hypot (line->Point2.X - line->Point1.X,
+      line->Point2.Y - line->Point1.Y);
+    double d = line_side (line, pl->cx, pl->cy) / len;
+    double seg = circle_segment_area (pl->radius, fabs (d));
+
+    *small = seg;
+    *big = M_PI * pl->radius * pl->radius - seg;
+    /* the small part is on the side away from the centre */
+    sign = d > 0 ? -1 : 1;
+  }
+  else
+  {
+    *small = pos.area;
+    *big = fabs (pl->area) - pos.area;
+    sign = 1;
+    if (*big < *small)
+    {
+      double swap = *small;
+
+      *small = *big;
+      *big = swap;
+      sign = -1;
+    }
+  }
+  if (sign > 0)
+  {
+    *small_out = pos;
+  }
+  else
+  {
+    convex_half (pl, line, -1, &neg);
+    *small_out = neg;
+  }
+  return true;
+}
+
+/*!
+ * \brief Squared distance from point P to segment AB.
+ */
+static double
+point_seg_dist2 (double px, double py, double ax, double ay, double bx, double by)
+{
+  double dx = bx - ax, dy = by - ay;
+  double len2 = dx * dx + dy * dy;
+  double t = 0;
+
+  if (len2 > 0)
+  {
+    t = ((px - ax) * dx + (py - ay) * dy) / len2;
+    if (t < 0)
+      t = 0;
+    else if (t > 1)
+      t = 1;
+  }
+  dx = ax + t * dx - px;
+  dy = ay + t * dy - py;
+  return dx * dx + dy * dy;
+}
+
+/*!
+ * \brief Squared distance between segments AB and CD, 0 if they cross.
+ */
+static double
+seg_seg_dist2 (double ax, double ay, double bx, double by,
+  double cx, double cy, double dx, double dy)
+{
+  double d1, d2, d3, d4, best;
+
+  d1 = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+  d2 = (bx - ax) * (dy - ay) - (by - ay) * (dx - ax);
+  d3 = (dx - cx) * (ay - cy) - (dy - cy) * (ax - cx);
+  d4 = (dx - cx) * (by - cy) - (dy - cy) * (bx - cx);
+  if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0))
+    && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+  {
+    return 0;
+  }
+  best = point_seg_dist2 (ax, ay, cx, cy, dx, dy);
+  MAKEMIN (best, point_seg_dist2 (bx, by, cx, cy, dx, dy));
+  MAKEMIN (best, point_seg_dist2 (cx, cy, ax, ay, bx, by));
+  MAKEMIN (best, point_seg_dist2 (dx, dy, ax, ay, bx, by));
+  return best;
+}
+
+/*!
+ * \brief Check whether a line, drawn at its thickness, can touch the
+ * brush at all.
+ *
+ * The line is taken as the capsule around its centreline with the
+ * half width LinePoly() uses, or for square ended lines the capsule
+ * reaching out to the corners of their ends.  It touches the brush if an
+ * endpoint is inside the brush or the centreline comes within the
+ * radius of one of the brush edges.  The polygon LinePoly() builds lies
+ * inside that capsule, so when this says no, Touching() would say no as
+ * well; for square ended lines it may say yes when Touching() would not.
+ */
+static bool
+jostle_capsule_touches (POLYAREA *brush, LineType *line)
+{
+  double r = (line->Thickness + 1) / 2
+    * (TEST_FLAG (SQUAREFLAG, line) ? M_SQRT2 : 1);
+  double r2 = r * r;
+  double ax = line->Point1.X, ay = line->Point1.Y;
+  double bx = line->Point2.X, by = line->Point2.Y;
+  double lxmin = MIN (ax, bx) - r, lxmax = MAX (ax, bx) + r;
+  double lymin = MIN (ay, by) - r, lymax = MAX (ay, by) + r;
+  POLYAREA *n = brush;
+  PLINE *pl;
+  VNODE *v;
+  Vector p;
+
+  do
+  {
+    p[0] = line->Point1.X;
+    p[1] = line->Point1.Y;
+    if (poly_CheckInside (n, p))
+      return true;
+    p[0] = line->Point2.X;
+    p[1] = line->Point2.Y;
+    if (poly_CheckInside (n, p))
+      return true;
+    for (pl = n->contours; pl; pl = pl->next)
+    {
+      if (pl->xmax < lxmin || pl->xmin > lxmax
+        || pl->ymax < lymin || pl->ymin > lymax)
+        continue;
+      v = &pl->head;
+      do
+      {
+        if (MAX (v->point[0], v->next->point[0]) < lxmin
+          || MIN (v->point[0], v->next->point[0]) > lxmax
+          || MAX (v->point[1], v->next->point[1]) < lymin
+          || MIN (v->point[1], v->next->point[1]) > lymax)
+          continue;
+        if (seg_seg_dist2 (ax, ay, bx, by, v->point[0], v->point[1],
+          v->next->point[0], v->next->point[1]) <= r2)
+          return true;
+      } while ((v = v->next) != &pl->head);
+    }
+  } while ((n = n->f) != brush);
+  return false;
+}
+
+static int
+endpoint_fill_callback (const BoxType *targ, void *private)
+{
+  struct endpoint_entry *e = private;
+  LineType *line = (LineType *) targ;
+
+  if ((line->Point1.X == e->x && line->Point1.Y == e->y)
+    || (line->Point2.X == e->x && line->Point2.Y == e->y))
+  {
+    endpoint_entry_add (e, line);
+  }
+  return 1;
+}
+
+struct endpoint_arc_fill
+{
+  struct info *info;
+  struct endpoint_entry *e;
+};
+
+/*!
+ * \brief Arcs ending at the point count with their end lines.
+ */
+static int
+endpoint_arc_fill_callback (const BoxType *targ, void *private)
+{
+  struct endpoint_arc_fill *fill = private;
+  struct endpoint_entry *e = fill->e;
+  ArcType *arc = (ArcType *) targ;
+  struct arccache_entry *c;
+
+  if (ptrset_contains (&fill->info->plan->gone, arc))
+    return 1;
+  if (arc->Point1.X == e->x && arc->Point1.Y == e->y)
+  {
+    c = jostle_arc (fill->info, arc);
+    endpoint_entry_add (e, &c->segs[0].line);
+  }
+  else if (arc->Point2.X == e->x && arc->Point2.Y == e->y)
+  {
+    c = jostle_arc (fill->info, arc);
+    endpoint_entry_add (e, &c->segs[c->segs_n - 1].line);
+  }
+  return 1;
+}
+
+/*!
+ * \brief The lines ending at (x, y), as the board would look with the
+ * plan so far applied, plus some that have been removed since.
+ */
+static struct endpoint_entry *
+jostle_endpoint (struct info *info, Coord x, Coord y)
+{
+  struct jostle_plan *plan = info->plan;
+  struct endpoint_entry *e;
+  BoxType box;
+  int i;
+
+  if ((e = endpoint_map_find (&plan->ends, x, y)) != NULL)
+    return e;
+  e = endpoint_map_insert (&plan->ends, x, y);
+  box.X1 = x;
+  box.Y1 = y;
+  box.X2 = x + 1;
+  box.Y2 = y + 1;
+  r_search (info->layer->line_tree, &box, NULL, endpoint_fill_callback, e);
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    endpoint_fill_callback (&plan->lines[i]->BoundingBox, e);
+  }
+  return e;
+}
+
+/*!
+ * \brief The lines standing for arcs that end at (x, y).
+ *
+ * They are made for each brush, so unlike jostle_endpoint() these are
+ * only kept for the brush.
+ */
+static struct endpoint_entry *
+jostle_arc_endpoint (struct info *info, Coord x, Coord y)
+{
+  struct endpoint_arc_fill fill;
+  BoxType box;
+  int i;
+
+  if ((fill.e = endpoint_map_find (&info->arc_ends, x, y)) != NULL)
+    return fill.e;
+  fill.e = endpoint_map_insert (&info->arc_ends, x, y);
+  fill.info = info;
+  box.X1 = x;
+  box.Y1 = y;
+  box.X2 = x + 1;
+  box.Y2 = y + 1;
+  if (info->layer->arc_tree)
+  {
+    r_search (info->layer->arc_tree, &box, NULL, endpoint_arc_fill_callback,
+      &fill);
+  }
+  for (i = 0; i < info->plan->arcs_n; i++)
+  {
+    endpoint_arc_fill_callback (&info->plan->arcs[i]->BoundingBox, &fill);
+  }
+  return fill.e;
+}
+
+static bool
+jostle_point_inside (struct info *info, Coord x, Coord y)
+{
+  Vector p;
+
+  p[0] = x;
+  p[1] = y;
+  return poly_InsideContour (info->brush->contours, p);
+}
+
+/*!
+ * \brief Follow the trace \p line is part of both ways, through the
+ * brush to the first point outside it.
+ *
+ * Gives up, returning NULL, if the trace ends or branches inside the
+ * brush, changes width, or runs into a line this brush made.
+ */
+static struct jostle_chain *
+jostle_follow_chain (struct info *info, LineType *line)
+{
+  struct jostle_chain *chain;
+  struct endpoint_entry *e, *a;
+  LineType **lines = NULL, *cur, *next, *l;
+  PointType out[2];
+  int lines_n = 0, lines_max = 0;
+  int dir, i;
+  Coord x, y;
+
+  lines = (LineType **) grow_array (lines, lines_n, &lines_max,
+    sizeof (LineType *));
+  lines[lines_n++] = line;
+  for (dir = 0; dir < 2; dir++)
+  {
+    cur = line;
+    x = dir ? line->Point2.X : line->Point1.X;
+    y = dir ? line->Point2.Y : line->Point1.Y;
+    while (jostle_point_inside (info, x, y))
+    {
+      e = jostle_endpoint (info, x, y);
+      a = jostle_arc_endpoint (info, x, y);
+      next = NULL;
+      for (i = 0; i < e->lines_n + a->lines_n; i++)
+      {
+        l = i < e->lines_n ? e->lines[i] : a->lines[i - e->lines_n];
+        if (l == cur
+          || ptrset_contains (&info->plan->gone, l)
+          || ptrset_contains (&info->arc_gone, l))
+          continue;
+        if (next != NULL)
+          goto fail; /* branches */
+        next = l;
+      }
+      if (next == NULL || TEST_FLAG (DRCFLAG, next)
+        || next->Thickness != line->Thickness
+        || next->Clearance != line->Clearance
+        || lines_n == JOSTLE_MAX_CHAIN)
+        goto fail;
+      for (i = 0; i < lines_n; i++)
+      {
+        if (lines[i] == next)
+          goto fail; /* goes round in a loop */
+      }
+      lines = (LineType **) grow_array (lines, lines_n, &lines_max,
+        sizeof (LineType *));
+      lines[lines_n++] = next;
+      /* carry on from its other end */
+      if (next->Point1.X == x && next->Point1.Y == y)
+      {
+        x = next->Point2.X;
+        y = next->Point2.Y;
+      }
+      else
+      {
+        x = next->Point1.X;
+        y = next->Point1.Y;
+      }
+      cur = next;
+    }
+    out[dir].X = x;
+    out[dir].Y = y;
+  }
+  if (out[0].X == out[1].X && out[0].Y == out[1].Y)
+    goto fail;
+  chain = (struct jostle_chain *) calloc (1, sizeof (struct jostle_chain));
+  chain->line = *line;
+  chain->line.Point1 = out[0];
+  chain->line.Point2 = out[1];
+  CLEAR_FLAG (DRCFLAG, &chain->line);
+  SetLineBoundingBox (&chain->line);
+  chain->lines = lines;
+  chain->lines_n = lines_n;
+  info->chains = (struct jostle_chain **) grow_array (info->chains,
+    info->chains_n, &info->chains_max, sizeof (struct jostle_chain *));
+  info->chains[info->chains_n++] = chain;
+  ptrset_add (&info->chain_lines, chain);
+  for (i = 0; i < lines_n; i++)
+    ptrset_add (&info->chained, lines[i]);
+  return chain;
+
+fail:
+  free (lines);
+  return NULL;
+}
+
+/*!
+ * \brief The trace \p line is part of, through the brush.
+ *
+ * Each trace is followed once and kept for the rest of the brush, so
+ * its polygons are made once too.  It is only followed again once the
+ * brush has grown over one of its ends, or part of it has gone.
+ */
+static struct jostle_chain *
+jostle_chain_of (struct info *info, LineType *line)
+{
+  struct jostle_chain *chain;
+  int i, j;
+
+  if (!ptrset_contains (&info->chained, line))
+    return jostle_follow_chain (info, line);
+  for (i = info->chains_n - 1; i >= 0; i--)
+  {
+    chain = info->chains[i];
+    if (chain->stale)
+      continue;
+    for (j = 0; j < chain->lines_n; j++)
+    {
+      if (chain->lines[j] == line)
+        break;
+    }
+    if (j == chain->lines_n)
+      continue;
+    for (j = 0; j < chain->lines_n; j++)
+    {
+      if (ptrset_contains (&info->plan->gone, chain->lines[j])
+        || ptrset_contains (&info->arc_gone, chain->lines[j]))
+        break;
+    }
+    if (j == chain->lines_n
+      && !jostle_point_inside (info, chain->line.Point1.X,
+        chain->line.Point1.Y)
+      && !jostle_point_inside (info, chain->line.Point2.X,
+        chain->line.Point2.Y))
+      return chain;
+    chain->stale = true;
+    break;
+  }
+  return jostle_follow_chain (info, line);
+}
+
+/*!
+ * \brief Never look at \p line again for this brush, nor at any line
+ * of the trace it stands in for.
+ */
+static void
+jostle_retire (struct info *info, LineType *line)
+{
+  struct jostle_chain *chain = (struct jostle_chain *) line;
+  int i;
+
+  if (!ptrset_contains (&info->chain_lines, line))
+  {
+    ptrset_add (&info->visited, line);
+    return;
+  }
+  for (i = 0; i < chain->lines_n; i++)
+    ptrset_add (&info->visited, chain->lines[i]);
+}
+
+/*!
+ * Process a line from the worklist against our 'brush'.
+ */
+static int
+jostle_callback (LineType *line, struct info *info)
+{
+  POLYAREA *lp, *tmp = NULL, *n, *smallest = NULL;
+  Vector p;
+  BoxType box;
+  struct slice cut;
+  int inside = 0, side, r;
+  double small, big;
+  int nocentroid = 0;
+
+  if (TEST_FLAG (DRCFLAG, line) || ptrset_contains (&info->arc_gone, line))
+  {
+    /* ours, or part of an arc replaced since it was queued */
+    return JOSTLE_REJECT;
+  }
+  JOSTLE_LOG ("hit! %p\n", (void *) line);
+  p[0] = line->Point1.X;
+  p[1] = line->Point1.Y;
+  if (poly_InsideContour (info->brush->contours, p))
+  {
+    JOSTLE_LOG ("\tinside1 %ms,%ms\n", p[0],p[1]);
+    inside++;
+  }
+  p[0] = line->Point2.X;
+  p[1] = line->Point2.Y;
+  if (poly_InsideContour (info->brush->contours, p))
+  {
+    JOSTLE_LOG ("\tinside2 %ms,%ms\n", p[0],p[1]);
+    inside++;
+  }
+  info->plan->stats.prefilter_tests++;
+  if (!jostle_capsule_touches (info->brush, line))
+  {
+    /* not a factor, and no need for a polygon to find that out */
+    info->plan->stats.prefilter_rejects++;
+    return JOSTLE_DROP;
+  }
+  lp = polycache_get (&info->polys, line, line->Thickness);
+  if (!jostle_touching (info, lp, info->brush))
+  {
     /* not a factor */
+    return JOSTLE_DROP;
+  }
+  if (inside)
+  {
+    struct jostle_chain *chain;
+
+    /* part of a trace passing through, go around all of it at once.
+     * XXX if it just ends in here, shorten it??
+     */
+    chain = jostle_chain_of (info, line);
+    if (chain == NULL)
+    {
+      return JOSTLE_REJECT;
+    }
+    if (chain->round == info->round)
+    {
+      /* the same trace is looked at once per round, from the first of
+       * its lines on the worklist.
+       */
+      return JOSTLE_KEEP;
+    }
+    chain->round = info->round;
+    line = &chain->line;
+    if (!jostle_capsule_touches (info->brush, line)
+      || !jostle_touching (info,
+        polycache_get (&info->polys, line, line->Thickness),
+        info->brush))
+    {
+      /* a trace going in and out on the same side */
+      return JOSTLE_REJECT;
+    }
+  }
+  /*
+   * Cut the brush with the line to figure out which side to go
+   * around.  A convex brush is cut in closed form, anything else by
+   * subtracting a very fine line.  XXX can still graze.
+   */
+  if (info->brush_convex
+    && jostle_slice_convex (info, line, &cut, &small, &big))
+  {
+    JOSTLE_LOG ("\t\tconvex cut %g/%g\n", small, big);
+  }
+  else
+  {
+    lp = polycache_get (&info->polys, line, 1);
+    r = jostle_boolean (info, info->brush, lp, &tmp, PBO_SUB);
+    if (r != err_ok)
+    {
+      pcb_fprintf (stderr, "Error while jostling PBO_SUB: %d\n", r);
+      return JOSTLE_REJECT;
+    }
+    if (tmp == tmp->f)
+    {
+      /* it didn't slice, must have glanced. intersect instead
+       * to get the glancing sliver??
+       */
+      JOSTLE_LOG ("try isect??\n");
+      poly_M_Copy0 (&lp, polycache_get (&info->polys, line, line->Thickness));
+      r = jostle_boolean_free (info, tmp, lp, &tmp, PBO_ISECT);
+      if (r != err_ok)
+      {
+        fprintf (stderr, "Error while jostling PBO_ISECT: %d\n", r);
+        return JOSTLE_REJECT;
+      }
+      nocentroid = 1;
+    }
+    /* XXX if this operation did not create two chunks, bad things are about to happen */
+    if (! tmp)
+      return JOSTLE_REJECT;
+    n = tmp;
+    small = big = tmp->contours->area;
+    do
+    {
+      JOSTLE_LOG ("\t\tarea %g, %ms,%ms %ms,%ms\n", n->contours->area, n->contours->xmin,n->contours->ymin, n->contours->xmax,n->contours->ymax);
+      if (n->contours->area <= small)
+      {
+        smallest = n;
+        small = n->contours->area;
+      }
+      if (n->contours->area >= big)
+      {
+        big = n->contours->area;
+      }
+    } while((n = n->f) != tmp);
+    JOSTLE_RECORD_POLY (JOSTLE_STEP_SLICE, smallest);
+    /* only the extremes of the slice are needed from here on */
+    kdop_of_PLINE (&cut.k, smallest->contours);
+    poly_Free (&tmp);
+  }
+  box.X1 = cut.k.min[KDOP_X];
+  box.Y1 = cut.k.min[KDOP_Y];
+  box.X2 = cut.k.max[KDOP_X];
+  box.Y2 = cut.k.max[KDOP_Y];
+  if (line->Point1.X == line->Point2.X)
+  { /* | */
+    if (info->box.X2 - box.X2 > box.X1 - info->box.X1)
+    {
+      side = WEST;
+    }
+    else
+    {
+      side = EAST;
+    }
+  }
+  else if (line->Point1.Y == line->Point2.Y)
+  { /* - */
+    if (info->box.Y2 - box.Y2 > box.Y1 - info->box.Y1)
+    {
+      side = NORTH;
+    }
+    else
+    {
+      side = SOUTH;
+    }
+  }
+  else if ((line->Point1.X > line->Point2.X) ==
+    (line->Point1.Y > line->Point2.Y))
+  { /* \ */
+    if (info->box.X2 - box.X2 > box.X1 - info->box.X1)
+    {
+      side = SOUTHWEST;
+    }
+    else
+    {
+      side = NORTHEAST;
+    }
+  }
+  else
+  { /* / */
+    if (info->box.X2 - box.X2 > box.X1 - info->box.X1)
+    {
+      side = NORTHWEST;
+    }
+    else
+    {
+      side = SOUTHEAST;
+    }
+  }
+  JOSTLE_LOG ("\t%s\n", dirnames[side]);
+  if (info->line == NULL ||
+    (!nocentroid && (big - small) < info->centroid))
+  {
+    JOSTLE_LOG ("\tkeep it!\n");
+    info->centroid = nocentroid ? DBL_MAX : (big - small);
+    info->side = side;
+    info->line = line;
+    info->smallest = cut.k;
+    return JOSTLE_BEST;
+  }
+  return JOSTLE_KEEP;
+}
+
+/*!
+ * \brief Count the vertices of all contours of a POLYAREA.
+ */
+static int
+POLYAREA_vertexCount (POLYAREA *a)
+{
+  POLYAREA *n = a;
+  PLINE *pl;
+  int count = 0;
+
+  do
+  {
+    for (pl = n->contours; pl; pl = pl->next)
+      count += pl->Count;
+  } while ((n = n->f) != a);
+  return count;
+}
+
+static int
+hull_compare (const void *va, const void *vb)
+{
+  const Coord *a = va, *b = vb;
+
+  if (a[0] != b[0])
+    return a[0] < b[0] ? -1 : 1;
+  if (a[1] != b[1])
+    return a[1] < b[1] ? -1 : 1;
+  return 0;
+}
+
+static double
+hull_cross (Coord *o, Coord *a, Coord *b)
+{
+  return (double) (a[0] - o[0]) * (b[1] - o[1])
+    - (double) (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+/*!
+ * \brief Convex hull of the outer contours of a POLYAREA.
+ *
+ * Monotone chain; returns the number of hull points written to \p hull
+ * (counter-clockwise), which must have room for twice the vertices.
+ */
+static int
+POLYAREA_convexHull (POLYAREA *a, Coord (*hull)[2])
+{
+  POLYAREA *n = a;
+  VNODE *v;
+  Coord (*pts)[2];
+  int i, k = 0, lower, count = 0;
+
+  do
+  {
+    count += n->contours->Count;
+  } while ((n = n->f) != a);
+  pts = (Coord (*)[2]) malloc (count * sizeof (*pts));
+  count = 0;
+  do
+  {
+    v = &n->contours->head;
+    do
+    {
+      pts[count][0] = v->point[0];
+      pts[count++][1] = v->point[1];
+    } while ((v = v->next) != &n->contours->head);
+  } while ((n = n->f) != a);
+  qsort (pts, count, sizeof (*pts), hull_compare);
+  for (i = 0; i < count; i++)
+  {
+    while (k >= 2 && hull_cross (hull[k - 2], hull[k - 1], pts[i]) <= 0)
+      k--;
+    hull[k][0] = pts[i][0];
+    hull[k++][1] = pts[i][1];
+  }
+  for (i = count - 2, lower = k + 1; i >= 0; i--)
+  {
+    while (k >= lower && hull_cross (hull[k - 2], hull[k - 1], pts[i]) <= 0)
+      k--;
+    hull[k][0] = pts[i][0];
+    hull[k++][1] = pts[i][1];
+  }
+  free (pts);
+  /* the last point repeats the first */
+  return k - 1;
+}
+
+/*!
+ * \brief Where pushing edge i of a convex polygon outwards until it
+ * vanishes would put the new corner, and how much area that adds.
+ *
+ * That is the point where the extended edges before and after it meet.
+ * Returns false if they diverge, so the edge can't be removed.
+ */
+static bool
+hull_collapse (Coord (*h)[2], int n, int i, double *x, double *y, double *area)
+{
+  Coord *p0 = h[(i + n - 1) % n], *p1 = h[i];
+  Coord *p2 = h[(i + 1) % n], *p3 = h[(i + 2) % n];
+  double d1x = p1[0] - p0[0], d1y = p1[1] - p0[1];
+  double d2x = p2[0] - p3[0], d2y = p2[1] - p3[1];
+  double den = d1x * d2y - d1y * d2x;
+  double s;
+
+  if (den == 0)
+    return false;
+  /* p1 + s * d1 == p2 + t * d2, both s and t must be positive */
+  s = ((p2[0] - p1[0]) * d2y - (p2[1] - p1[1]) * d2x) / den;
+  if (s <= 0 || ((p2[0] - p1[0]) * d1y - (p2[1] - p1[1]) * d1x) / den <= 0)
+    return false;
+  *x = p1[0] + s * d1x;
+  *y = p1[1] + s * d1y;
+  *area = fabs ((p2[0] - p1[0]) * (*y - p1[1]) - (p2[1] - p1[1]) * (*x - p1[0])) / 2;
+  return true;
+}
+
+/*!
+ * \brief Queue the lines in \p box, as the board would look with the
+ * plan so far applied.
+ */
+static void
+jostle_search (struct info *info, const BoxType *box)
+{
+  struct jostle_plan *plan = info->plan;
+  int i;
+
+  if (info->layer->arc_tree)
+  {
+    r_search (info->layer->arc_tree, box, NULL, jostle_arc_callback, info);
+  }
+  for (i = 0; i < plan->arcs_n; i++)
+  {
+    if (box_overlap (&plan->arcs[i]->BoundingBox, box))
+      jostle_arc_callback (&plan->arcs[i]->BoundingBox, info);
+  }
+  r_search (info->layer->line_tree, box, NULL, jostle_enqueue_callback, info);
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    if (box_overlap (&plan->lines[i]->BoundingBox, box))
+      jostle_enqueue_callback (&plan->lines[i]->BoundingBox, info);
+  }
+}
+
+/*!
+ * \brief Queue the lines near the area a bypass, or trimming, is about
+ * to add to the brush.
+ *
+ * Only the part of \p expand not already covered by the brush can bring
+ * new lines into contact, so search just that instead of the whole
+ * grown brush.
+ */
+static void
+jostle_enqueue_delta (struct info *info, POLYAREA *expand)
+{
+  POLYAREA *delta = NULL, *n;
+  BoxType box;
+
+  if (jostle_boolean (info, expand, info->brush, &delta, PBO_SUB) != err_ok)
+  {
+    /* fall back to everything the bypass covers */
+    box = POLYAREA_boundingBox (expand);
+    jostle_search (info, &box);
+    return;
+  }
+  if (delta == NULL)
+  {
+    return;
+  }
+  n = delta;
+  do
+  {
+    box.X1 = n->contours->xmin;
+    box.X2 = n->contours->xmax + 1;
+    box.Y1 = n->contours->ymin;
+    box.Y2 = n->contours->ymax + 1;
+    jostle_search (info, &box);
+  } while ((n = n->f) != delta);
+  poly_Free (&delta);
+}
+
+/*!
+ * \brief Keep the brush within the vertex budget.
+ *
+ * The brush only has to cover everything jostled so far; a bigger brush
+ * is fine.  So when it has too many vertices, replace it by its convex
+ * hull, and if that is still too big, keep removing the edge whose
+ * removal adds the least area by extending its neighbours until they
+ * meet.  Both steps only ever grow the brush, and the lines near what
+ * they add are queued like those near a bypass.
+ */
+static void
+jostle_trim_brush (struct info *info)
+{
+  Coord (*hull)[2];
+  PLINE *contour = NULL;
+  POLYAREA *np;
+  Vector v;
+  double x, y, area, best_x = 0, best_y = 0, best_area;
+  double cx = 0, cy = 0;
+  int i, n, best;
+
+  info->brush_vertices = POLYAREA_vertexCount (info->brush);
+  if (info->brush_vertices <= jostle_brush_budget)
+    return;
+  hull = (Coord (*)[2]) malloc (2 * info->brush_vertices * sizeof (*hull));
+  n = POLYAREA_convexHull (info->brush, hull);
+  for (i = 0; i < n; i++)
+  {
+    cx += hull[i][0];
+    cy += hull[i][1];
+  }
+  cx /= n;
+  cy /= n;
+  while (n > jostle_brush_budget)
+  {
+    best = -1;
+    best_area = DBL_MAX;
+    for (i = 0; i < n; i++)
+    {
+      if (hull_collapse (hull, n, i, &x, &y, &area) && area < best_area)
+      {
+        best = i;
+        best_area = area;
+        best_x = x;
+        best_y = y;
+      }
+    }
+    if (best < 0)
+      break;
+    /* round away from the middle so the corner never moves inwards */
+    hull[best][0] = best_x > cx ? ceil (best_x) : floor (best_x);
+    hull[best][1] = best_y > cy ? ceil (best_y) : floor (best_y);
+    /* and drop the other end of the edge */
+    i = (best + 1) % n;
+    memmove (hull[i], hull[i + 1], (n - i - 1) * sizeof (*hull));
+    n--;
+  }
+  for (i = 0; i < n; i++)
+  {
+    v[0] = hull[i][0];
+    v[1] = hull[i][1];
+    if (contour == NULL)
+      contour = poly_NewContour (v);
+    else
+      poly_InclVertex (contour->head.prev, poly_CreateNode (v));
+  }
+  free (hull);
+  poly_PreContour (contour, TRUE);
+  if (contour->Flags.orient != PLF_DIR)
+    poly_InvContour (contour);
+  if ((np = poly_Create ()) == NULL)
+  {
+    poly_DelContour (&contour);
+    return;
+  }
+  poly_InclContour (np, contour);
+  jostle_enqueue_delta (info, np);
+  poly_Free (&info->brush);
+  info->brush = np;
+  info->brush_vertices = n;
+  /* pushing edges out moved the extremes */
+  kdop_of_POLYAREA (&info->brush_kdop, info->brush);
+}
+
+/*!
+ * \brief Plan pushing lines out of the way of \p brush, which is freed.
+ *
+ * Adds the bypasses to \p plan, seeing the board as it would be with
+ * the plan so far applied.  Does not touch the board, so several plans
+ * for separate parts of it can be made at the same time.
+ */
+static void
+jostle_plan_poly (struct jostle_plan *plan, POLYAREA *brush)
+{
+  POLYAREA *expand;
+  struct info info;
+  LineType *line;
+  int i, keep;
+
+  memset (&info, 0, sizeof (info));
+  info.plan = plan;
+  info.layer = plan->layer;
+  /* lines planned for an earlier brush are fair game again, like lines
+   * a previous Jostle() made.
+   */
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    CLEAR_FLAG (DRCFLAG, plan->lines[i]);
+  }
+  info.brush = brush;
+  info.brush_vertices = POLYAREA_vertexCount (info.brush);
+  MAKEMAX (plan->stats.peak_vertices, info.brush_vertices);
+  kdop_of_POLYAREA (&info.brush_kdop, info.brush);
+  /* arcs are followed closely enough for this brush */
+  info.tolerance = MAX ((info.brush_kdop.max[KDOP_X]
+    - info.brush_kdop.min[KDOP_X]) / 32, 1);
+  /* seed the worklist once, later searches only cover what each
+   * bypass adds to the brush.
+   */
+  info.box = POLYAREA_boundingBox (info.brush);
+  jostle_search (&info, &info.box);
+  while (info.work_n > 0)
+  {
+    if (plan->cancel && *plan->cancel)
+    {
+      /* nobody wants this plan any more */
+      break;
+    }
+    plan->stats.iterations++;
+    plan->stats.brush_rounds++;
+    info.round++;
+    plan->stats.vertices += info.brush_vertices;
+    info.box.X1 = info.brush_kdop.min[KDOP_X];
+    info.box.Y1 = info.brush_kdop.min[KDOP_Y];
+    info.box.X2 = info.brush_kdop.max[KDOP_X] + 1;
+    info.box.Y2 = info.brush_kdop.max[KDOP_Y] + 1;
+    JOSTLE_RECORD_POLY (JOSTLE_STEP_BRUSH, info.brush);
+    JOSTLE_LOG ("worklist %d, brush %d vertices (%ms,%ms)->(%ms,%ms):\n",
+      info.work_n, info.brush_vertices,
+      info.box.X1,info.box.Y1, info.box.X2,info.box.Y2);
+    info.line = NULL;
+    info.brush_convex = POLYAREA_isConvex (info.brush);
+    for (i = keep = 0; i < info.work_n; i++)
+    {
+      line = info.work[i];
+      switch (jostle_callback (line, &info))
+      {
+        case JOSTLE_REJECT:
+          ptrset_add (&info.visited, line);
+          /* fall through */
+        case JOSTLE_DROP:
+          ptrset_remove (&info.queued, line);
+          break;
+        default:
+          info.work[keep++] = line;
+          break;
+      }
+    }
+    info.work_n = keep;
+    if (info.line == NULL)
+    {
+      break;
+    }
+    /* the chosen line, or trace, is replaced (or given up on), never
+     * retry it
+     */
+    jostle_retire (&info, info.line);
+    for (i = keep = 0; i < info.work_n; i++)
+    {
+      if (ptrset_contains (&info.visited, info.work[i]))
+        ptrset_remove (&info.queued, info.work[i]);
+      else
+        info.work[keep++] = info.work[i];
+    }
+    info.work_n = keep;
+    expand = NULL;
+    MakeBypassingLines (&info, &info.smallest, info.line,
+      info.side, &expand);
+    for (i = 0; i < info.arcs_hit_n; i++)
+      jostle_replace_arc (&info, info.arcs_hit[i]);
+    info.arcs_hit_n = 0;
+    if (expand)
+    {
+      struct kdop grown;
+
+      JOSTLE_RECORD_POLY (JOSTLE_STEP_BYPASS, expand);
+      jostle_enqueue_delta (&info, expand);
+      kdop_of_POLYAREA (&grown, expand);
+      kdop_merge (&info.brush_kdop, &grown);
+      jostle_boolean_free (&info, info.brush, expand, &info.brush, PBO_UNITE);
+      MAKEMAX (plan->stats.peak_vertices, POLYAREA_vertexCount (info.brush));
+      jostle_trim_brush (&info);
+    }
+  }
+  /* every search was inside the final brush */
+  info.box.X1 = info.brush_kdop.min[KDOP_X];
+  info.box.Y1 = info.brush_kdop.min[KDOP_Y];
+  info.box.X2 = info.brush_kdop.max[KDOP_X] + 1;
+  info.box.Y2 = info.brush_kdop.max[KDOP_Y] + 1;
+  box_grow (&plan->looked, &info.box);
+  poly_Free (&info.brush);
+  polycache_free (&info.polys);
+  arccache_free (&info.arcs);
+  endpoint_map_free (&info.arc_ends);
+  for (i = 0; i < info.chains_n; i++)
+  {
+    free (info.chains[i]->lines);
+    free (info.chains[i]);
+  }
+  free (info.chains);
+  ptrset_free (&info.chain_lines);
+  ptrset_free (&info.chained);
+  ptrset_free (&info.arc_lines);
+  ptrset_free (&info.arc_gone);
+  free (info.arcs_hit);
+  free (info.work);
+  ptrset_free (&info.queued);
+  ptrset_free (&info.visited);
+}
+
+/*!
+ * \brief Plan pushing lines out of the way of a round brush.
+ */
+static void
+jostle_plan_brush (struct jostle_plan *plan, Coord x, Coord y, Coord diameter)
+{
+  jostle_plan_poly (plan, CirclePoly (x, y, diameter / 2));
+}
+
+static int
+union_find (int *parent, int i)
+{
+  while (parent[i] != i)
+  {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+/*!
+ * \brief One line taking part in a relaxation: the part of it inside
+ * the window, as a run of nodes.
+ */
+struct relax_trace
+{
+  LineType *line;
+  int first, n;
+    /*!< its nodes. */
+  int group;
+    /*!< the trace, of lines joined end to end, it is part of. */
+  bool head, tail;
+    /*!< Point1 or Point2 is outside the window, and joins the first or
+     * last node with a straight line.
+     */
+};
+
+/*!
+ * \brief Where two lines of a trace meet: the end nodes \p a and \p b
+ * move as one, and \p na and \p nb are their neighbours.
+ */
+struct relax_joint
+{
+  int a, b, na, nb;
+};
+
+/*!
+ * \brief Nodes along the traces near a brush, moved all at once until
+ * they keep their distance from the brush and from each other.
+ *
+ * Node data is kept in separate arrays, and sorted by grid cell each
+ * round, so the distance loops run over plain contiguous arrays the
+ * compiler can vectorize.
+ */
+struct relax
+{
+  double cx, cy, radius;
+    /*!< the brush. */
+  BoxType window;
+  struct relax_trace *traces;
+  int traces_n, traces_max;
+  struct relax_joint *joints;
+  int joints_n, joints_max;
+  double *x, *y;
+  double *ox, *oy;
+    /*!< where each node started. */
+  double *body, *keep;
+    /*!< half the width, and half the width plus clearance. */
+  int *trace, *group;
+    /*!< the line, and the trace, each node is on. */
+  unsigned char *fixed;
+    /*!< the node stays put: it is at the end of a trace, on a pin, pad,
+     * via or arc, where traces branch, or on the edge of the window.
+     */
+  int n, max;
+  double reach;
+    /*!< furthest two nodes can be and still push each other. */
+  /* per round scratch, in grid cell order */
+  int *order, *cell_start, cells_w, cells_h;
+  double *sx, *sy, *sbody, *skeep, *ax, *ay, *acount, *d2;
+  int *sgroup;
+};
+
+#define RELAX_ROUNDS 200
+#define RELAX_GROW 4
+
+static int
+relax_node (struct relax *rx, double x, double y, LineType *line, int trace,
+  int group, bool fixed)
+{
+  int i;
+
+  if (rx->n == rx->max)
+  {
+    rx->max = rx->max ? rx->max * 2 : 256;
+    rx->x = (double *) realloc (rx->x, rx->max * sizeof (double));
+    rx->y = (double *) realloc (rx->y, rx->max * sizeof (double));
+    rx->ox = (double *) realloc (rx->ox, rx->max * sizeof (double));
+    rx->oy = (double *) realloc (rx->oy, rx->max * sizeof (double));
+    rx->body = (double *) realloc (rx->body, rx->max * sizeof (double));
+    rx->keep = (double *) realloc (rx->keep, rx->max * sizeof (double));
+    rx->trace = (int *) realloc (rx->trace, rx->max * sizeof (int));
+    rx->group = (int *) realloc (rx->group, rx->max * sizeof (int));
+    rx->fixed = (unsigned char *) realloc (rx->fixed, rx->max);
+  }
+  i = rx->n++;
+  rx->x[i] = rx->ox[i] = x;
+  rx->y[i] = rx->oy[i] = y;
+  rx->body[i] = line->Thickness / 2.0;
+  rx->keep[i] = (line->Thickness + line->Clearance) / 2.0;
+  rx->trace[i] = trace;
+  rx->group[i] = group;
+  rx->fixed[i] = fixed;
+  return i;
+}
+
+/*!
+ * \brief Clip the segment a-b to \p box, giving the parameter range
+ * inside it.
+ */
+static bool
+relax_clip (const BoxType *box, double ax, double ay, double bx, double by,
+  double *t0, double *t1)
+{
+  double p[4], q[4], r;
+  int i;
+
+  p[0] = ax - bx; q[0] = ax - box->X1;
+  p[1] = bx - ax; q[1] = box->X2 - ax;
+  p[2] = ay - by; q[2] = ay - box->Y1;
+  p[3] = by - ay; q[3] = box->Y2 - ay;
+  *t0 = 0;
+  *t1 = 1;
+  for (i = 0; i < 4; i++)
+  {
+    if (p[i] == 0)
+    {
+      if (q[i] < 0)
+        return false;
+      continue;
+    }
+    r = q[i] / p[i];
+    if (p[i] < 0)
+      *t0 = MAX (*t0, r);
+    else
+      *t1 = MIN (*t1, r);
+  }
+  return *t0 < *t1;
+}
+
+/*!
+ * \brief Make nodes along the part of \p line inside the window, at
+ * most \p spacing apart.
+ *
+ * End nodes on the edge of the window never move, nor do those at
+ * Point1 or Point2 when \p fix1 or \p fix2 says so.
+ *
+ * \return the index of the run of nodes, or -1 if the line is not in
+ * the window.
+ */
+static int
+relax_add_line (struct relax *rx, LineType *line, double spacing, int group,
+  bool fix1, bool fix2)
+{
+  struct relax_trace *t;
+  double ax = line->Point1.X, ay = line->Point1.Y;
+  double bx = line->Point2.X, by = line->Point2.Y;
+  double t0, t1, len, u;
+  int i, m;
+
+  if (!relax_clip (&rx->window, ax, ay, bx, by, &t0, &t1))
+    return -1;
+  rx->traces = (struct relax_trace *) grow_array (rx->traces, rx->traces_n,
+    &rx->traces_max, sizeof (struct relax_trace));
+  t = &rx->traces[rx->traces_n];
+  t->line = line;
+  t->first = rx->n;
+  t->group = group;
+  t->head = t0 > 0;
+  t->tail = t1 < 1;
+  len = hypot (bx - ax, by - ay) * (t1 - t0);
+  m = MAX (2, (int) ceil (len / spacing) + 1);
+  for (i = 0; i < m; i++)
+  {
+    u = t0 + (t1 - t0) * i / (m - 1);
+    relax_node (rx, ax + (bx - ax) * u, ay + (by - ay) * u, line,
+      rx->traces_n, group, (i == 0 && (t->head || fix1))
+        || (i == m - 1 && (t->tail || fix2)));
+  }
+  t->n = m;
+  return rx->traces_n++;
+}
+
+/*!
+ * \brief Move the two nodes of each joint to the middle of them.
+ */
+static void
+relax_join (struct relax *rx)
+{
+  struct relax_joint *j;
+  int i;
+
+  for (i = 0; i < rx->joints_n; i++)
+  {
+    j = &rx->joints[i];
+    rx->x[j->a] = rx->x[j->b] = (rx->x[j->a] + rx->x[j->b]) / 2;
+    rx->y[j->a] = rx->y[j->b] = (rx->y[j->a] + rx->y[j->b]) / 2;
+  }
+}
+
+/*!
+ * \brief Move nodes out of the brush.
+ */
+static double
+relax_brush (struct relax *rx)
+{
+  double dx, dy, d, min, worst = 0;
+  int i;
+
+  for (i = 0; i < rx->n; i++)
+  {
+    if (rx->fixed[i])
+      continue;
+    dx = rx->x[i] - rx->cx;
+    dy = rx->y[i] - rx->cy;
+    d = sqrt (dx * dx + dy * dy);
+    min = rx->radius + rx->body[i];
+    if (d >= min)
+      continue;
+    if (d == 0)
+    {
+      /* dead center, push along the trace's normal */
+      struct relax_trace *t = &rx->traces[rx->trace[i]];
+
+      dx = -(double) (t->line->Point2.Y - t->line->Point1.Y);
+      dy = t->line->Point2.X - t->line->Point1.X;
+      d = hypot (dx, dy);
+    }
+    rx->x[i] = rx->cx + dx / d * min;
+    rx->y[i] = rx->cy + dy / d * min;
+    MAKEMAX (worst, min - d);
+  }
+  return worst;
+}
+
+/*!
+ * \brief Pull each free node towards the middle of its neighbours, so
+ * traces bend smoothly instead of kinking, also where two lines meet.
+ */
+static void
+relax_smooth (struct relax *rx, double k)
+{
+  struct relax_trace *t;
+  struct relax_joint *jt;
+  int i, j;
+
+  for (j = 0; j < rx->traces_n; j++)
+  {
+    t = &rx->traces[j];
+    for (i = t->first + 1; i < t->first + t->n - 1; i++)
+    {
+      if (rx->fixed[i])
+        continue;
+      rx->x[i] += k * ((rx->x[i - 1] + rx->x[i + 1]) / 2 - rx->x[i]);
+      rx->y[i] += k * ((rx->y[i - 1] + rx->y[i + 1]) / 2 - rx->y[i]);
+    }
+  }
+  for (j = 0; j < rx->joints_n; j++)
+  {
+    jt = &rx->joints[j];
+    rx->x[jt->a] += k * ((rx->x[jt->na] + rx->x[jt->nb]) / 2 - rx->x[jt->a]);
+    rx->y[jt->a] += k * ((rx->y[jt->na] + rx->y[jt->nb]) / 2 - rx->y[jt->a]);
+    rx->x[jt->b] = rx->x[jt->a];
+    rx->y[jt->b] = rx->y[jt->a];
+  }
+}
+
+/*!
+ * \brief Push apart nodes of different traces that are too close, all
+ * at once.  The lines of one trace never push each other.
+ *
+ * Nodes are sorted into grid cells as wide as the reach, so only the
+ * neighbouring cells need looking at.  Each node moves by the average
+ * of the pushes it gets.
+ */
+static double
+relax_spacing (struct relax *rx)
+{
+  int cells = rx->cells_w * rx->cells_h;
+  int i, j, k, a, b, c, cx, cy, nx, ny, m, start;
+  double px, py, min, d, push, worst = 0;
+
+  /* counting sort by cell */
+  memset (rx->cell_start, 0, (cells + 1) * sizeof (int));
+  for (i = 0; i < rx->n; i++)
+  {
+    cx = MIN (MAX ((int) ((rx->x[i] - rx->window.X1) / rx->reach), 0),
+      rx->cells_w - 1);
+    cy = MIN (MAX ((int) ((rx->y[i] - rx->window.Y1) / rx->reach), 0),
+      rx->cells_h - 1);
+    rx->order[i] = cy * rx->cells_w + cx;
+    rx->cell_start[rx->order[i] + 1]++;
+  }
+  for (c = 0; c < cells; c++)
+    rx->cell_start[c + 1] += rx->cell_start[c];
+  for (i = 0; i < rx->n; i++)
+  {
+    j = rx->cell_start[rx->order[i]]++;
+    rx->sx[j] = rx->x[i];
+    rx->sy[j] = rx->y[i];
+    rx->sbody[j] = rx->body[i];
+    rx->skeep[j] = rx->keep[i];
+    rx->sgroup[j] = rx->group[i];
+    rx->order[i] = j;
+  }
+  /* cell_start[c] is now where cell c ends; shift back */
+  for (c = cells; c > 0; c--)
+    rx->cell_start[c] = rx->cell_start[c - 1];
+  rx->cell_start[0] = 0;
+  memset (rx->ax, 0, rx->n * sizeof (double));
+  memset (rx->ay, 0, rx->n * sizeof (double));
+  memset (rx->acount, 0, rx->n * sizeof (double));
+  for (cy = 0; cy < rx->cells_h; cy++)
+  {
+    for (cx = 0; cx < rx->cells_w; cx++)
+    {
+      a = cy * rx->cells_w + cx;
+      for (ny = cy; ny <= MIN (cy + 1, rx->cells_h - 1); ny++)
+      {
+        for (nx = MAX (cx - 1, 0); nx <= MIN (cx + 1, rx->cells_w - 1); nx++)
+        {
+          b = ny * rx->cells_w + nx;
+          if (b < a)
+            continue; /* each pair of cells once */
+          for (i = rx->cell_start[a]; i < rx->cell_start[a + 1]; i++)
+          {
+            px = rx->sx[i];
+            py = rx->sy[i];
+            start = b == a ? i + 1 : rx->cell_start[b];
+            m = rx->cell_start[b + 1] - start;
+            /* the distance kernel */
+            for (k = 0; k < m; k++)
+            {
+              double dx = rx->sx[start + k] - px;
+              double dy = rx->sy[start + k] - py;
+
+              rx->d2[k] = dx * dx + dy * dy;
+            }
+            for (k = 0; k < m; k++)
+            {
+              j = start + k;
+              min = MAX (rx->skeep[i] + rx->sbody[j],
+                rx->skeep[j] + rx->sbody[i]);
+              if (rx->d2[k] >= min * min || rx->sgroup[i] == rx->sgroup[j])
+                continue;
+              d = sqrt (rx->d2[k]);
+              if (d == 0)
+                continue;
+              push = (min - d) / 2 / d;
+              rx->ax[i] -= (rx->sx[j] - px) * push;
+              rx->ay[i] -= (rx->sy[j] - py) * push;
+              rx->ax[j] += (rx->sx[j] - px) * push;
+              rx->ay[j] += (rx->sy[j] - py) * push;
+              rx->acount[i]++;
+              rx->acount[j]++;
+              MAKEMAX (worst, min - d);
+            }
+          }
+        }
+      }
+    }
+  }
+  for (i = 0; i < rx->n; i++)
+  {
+    j = rx->order[i];
+    if (rx->fixed[i] || rx->acount[j] == 0)
+      continue;
+    rx->x[i] += rx->ax[j] / rx->acount[j];
+    rx->y[i] += rx->ay[j] / rx->acount[j];
+  }
+  return worst;
+}
+
+static void
+relax_free (struct relax *rx)
+{
+  free (rx->traces);
+  free (rx->joints);
+  free (rx->x);
+  free (rx->y);
+  free (rx->ox);
+  free (rx->oy);
+  free (rx->body);
+  free (rx->keep);
+  free (rx->trace);
+  free (rx->group);
+  free (rx->fixed);
+  free (rx->order);
+  free (rx->cell_start);
+  free (rx->sx);
+  free (rx->sy);
+  free (rx->sbody);
+  free (rx->skeep);
+  free (rx->sgroup);
+  free (rx->ax);
+  free (rx->ay);
+  free (rx->acount);
+  free (rx->d2);
+  memset (rx, 0, sizeof (*rx));
+}
+
+struct relax_collect
+{
+  struct jostle_plan *plan;
+  LineType **lines;
+  int lines_n, lines_max;
+};
+
+static int
+relax_collect_callback (const BoxType *targ, void *private)
+{
+  struct relax_collect *rc = private;
+  LineType *line = (LineType *) targ;
+
+  rc->plan->stats.search_hits++;
+  if (TEST_FLAG (DRCFLAG, line) || ptrset_contains (&rc->plan->gone, line))
+    return 0;
+  rc->lines = (LineType **) grow_array (rc->lines, rc->lines_n,
+    &rc->lines_max, sizeof (LineType *));
+  rc->lines[rc->lines_n++] = line;
+  return 1;
+}
+
+/*!
+ * \brief Lines in the window, as the board would look with the plan so
+ * far applied.
+ */
+static void
+relax_collect (struct jostle_plan *plan, const BoxType *window,
+  struct relax_collect *rc)
+{
+  int i;
+
+  rc->plan = plan;
+  rc->lines_n = 0;
+  r_search (plan->layer->line_tree, window, NULL, relax_collect_callback, rc);
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    if (box_overlap (&plan->lines[i]->BoundingBox, window))
+      relax_collect_callback ((const BoxType *) plan->lines[i], rc);
+  }
+}
+
+/*!
+ * \brief Solve for the node positions in the current window.
+ *
+ * \return the worst violation left.
+ */
+static double
+relax_solve (struct relax *rx, struct jostle_plan *plan)
+{
+  double worst = 0;
+  int round, n = rx->n;
+
+  rx->cells_w = MAX (1, (int) ceil ((rx->window.X2 - rx->window.X1) / rx->reach));
+  rx->cells_h = MAX (1, (int) ceil ((rx->window.Y2 - rx->window.Y1) / rx->reach));
+  rx->order = (int *) malloc (n * sizeof (int));
+  rx->cell_start = (int *) malloc ((rx->cells_w * rx->cells_h + 1) * sizeof (int));
+  rx->sx = (double *) malloc (n * sizeof (double));
+  rx->sy = (double *) malloc (n * sizeof (double));
+  rx->sbody = (double *) malloc (n * sizeof (double));
+  rx->skeep = (double *) malloc (n * sizeof (double));
+  rx->sgroup = (int *) malloc (n * sizeof (int));
+  rx->ax = (double *) malloc (n * sizeof (double));
+  rx->ay = (double *) malloc (n * sizeof (double));
+  rx->acount = (double *) malloc (n * sizeof (double));
+  rx->d2 = (double *) malloc (n * sizeof (double));
+  for (round = 0; round < RELAX_ROUNDS; round++)
+  {
+    plan->stats.iterations++;
+    if (plan->cancel && *plan->cancel)
+      break;
+    relax_smooth (rx, 0.5);
+    worst = relax_brush (rx);
+    MAKEMAX (worst, relax_spacing (rx));
+    relax_join (rx);
+    if (worst < 1)
+      break; /* within a nanometer */
+  }
+  return worst;
+}
+
+static void
+relax_point (Coord (**pts)[2], int *n, int *max, double x, double y)
+{
+  Coord (*p)[2];
+
+  *pts = grow_array (*pts, *n, max, sizeof (**pts));
+  p = *pts;
+  p[*n][0] = (Coord) floor (x + 0.5);
+  p[*n][1] = (Coord) floor (y + 0.5);
+  if (*n > 0 && p[*n][0] == p[*n - 1][0] && p[*n][1] == p[*n - 1][1])
+    return;
+  (*n)++;
+}
+
+/*!
+ * \brief Drop points of a polyline closer than \p eps to the line
+ * through their neighbours (Douglas-Peucker), marking the ones to keep.
+ */
+static void
+relax_simplify (Coord (*p)[2], bool *keep, int a, int b, double eps)
+{
+  double dx = p[b][0] - p[a][0], dy = p[b][1] - p[a][1];
+  double len = hypot (dx, dy), d, far = -1;
+  int i, best = -1;
+
+  for (i = a + 1; i < b; i++)
+  {
+    if (len == 0)
+      d = hypot (p[i][0] - p[a][0], p[i][1] - p[a][1]);
+    else
+      d = fabs (dx * (p[i][1] - p[a][1]) - dy * (p[i][0] - p[a][0])) / len;
+    if (d > far)
+    {
+      far = d;
+      best = i;
+    }
+  }
+  if (best < 0 || far <= eps)
+    return;
+  keep[best] = true;
+  relax_simplify (p, keep, a, best, eps);
+  relax_simplify (p, keep, best, b, eps);
+}
+
+/*!
+ * \brief Replace a relaxed trace by lines at multiples of 45 degrees.
+ *
+ * Each step that is not already at such an angle becomes a diagonal
+ * and a straight piece, bending on whichever side is further from the
+ * brush.
+ */
+static void
+relax_emit (struct relax *rx, struct jostle_plan *plan, struct relax_trace *t,
+  double eps)
+{
+  LineType *orig = t->line, *line;
+  Coord (*p)[2] = NULL, (*q)[2] = NULL;
+  int p_n = 0, p_max = 0, q_n = 0, q_max = 0, i, k;
+  bool *keep;
+  double dx, dy, m, sx, sy, d1, d2, c1x, c1y, c2x, c2y;
+
+  if (t->head)
+    relax_point (&p, &p_n, &p_max, orig->Point1.X, orig->Point1.Y);
+  for (i = t->first; i < t->first + t->n; i++)
+    relax_point (&p, &p_n, &p_max, rx->x[i], rx->y[i]);
+  if (t->tail)
+    relax_point (&p, &p_n, &p_max, orig->Point2.X, orig->Point2.Y);
+  keep = (bool *) calloc (p_n, sizeof (bool));
+  keep[0] = keep[p_n - 1] = true;
+  relax_simplify (p, keep, 0, p_n - 1, eps);
+  for (i = 0; i < p_n; i++)
+  {
+    if (!keep[i])
+      continue;
+    if (q_n > 0)
+    {
+      dx = p[i][0] - q[q_n - 1][0];
+      dy = p[i][1] - q[q_n - 1][1];
+      if (dx != 0 && dy != 0 && fabs (dx) != fabs (dy))
+      {
+        /* bend: diagonal first, or straight first */
+        m = MIN (fabs (dx), fabs (dy));
+        sx = dx > 0 ? 1 : -1;
+        sy = dy > 0 ? 1 : -1;
+        c1x = q[q_n - 1][0] + sx * m;
+        c1y = q[q_n - 1][1] + sy * m;
+        c2x = p[i][0] - sx * m;
+        c2y = p[i][1] - sy * m;
+        d1 = hypot (c1x - rx->cx, c1y - rx->cy);
+        d2 = hypot (c2x - rx->cx, c2y - rx->cy);
+        if (d1 >= d2)
+          relax_point (&q, &q_n, &q_max, c1x, c1y);
+        else
+          relax_point (&q, &q_n, &q_max, c2x, c2y);
+      }
+    }
+    relax_point (&q, &q_n, &q_max, p[i][0], p[i][1]);
+  }
+  for (i = 0; i + 1 < q_n; i = k)
+  {
+    /* run as far as the direction holds */
+    for (k = i + 1; k + 1 < q_n; k++)
+    {
+      if ((double) (q[k][0] - q[i][0]) * (q[k + 1][1] - q[i][1])
+        != (double) (q[k][1] - q[i][1]) * (q[k + 1][0] - q[i][0]))
+        break;
+    }
+    line = (LineType *) calloc (1, sizeof (LineType));
+    line->Point1.X = q[i][0];
+    line->Point1.Y = q[i][1];
+    line->Point2.X = q[k][0];
+    line->Point2.Y = q[k][1];
+    line->Thickness = orig->Thickness;
+    line->Clearance = orig->Clearance;
+    line->Flags = orig->Flags;
+    SET_FLAG (DRCFLAG, line); /* made by jostling */
+    SetLineBoundingBox (line);
+    jostle_plan_add (plan, line);
+  }
+  jostle_plan_remove (plan, orig);
+  free (keep);
+  free (p);
+  free (q);
+}
+
+/*!
+ * \brief Checking the lines a relaxation made against everything near
+ * them.
+ *
+ * The solver only keeps nodes apart, and emitting simplifies and bends
+ * the traces between nodes, so the lines themselves can still come too
+ * close to something.  This measures by how much.
+ */
+struct relax_check
+{
+  struct jostle_plan *plan;
+  struct relax *rx;
+  int first;
+    /*!< plan->lines from here on were made by the relaxation. */
+  int *groups;
+    /*!< the trace each of those lines was made for. */
+  LineType *line;
+  int group;
+    /*!< the line being checked, and its trace. */
+  bool top, bottom;
+    /*!< pads on that side of the board are on the layer. */
+  struct arccache arcs;
+  double worst;
+    /*!< the most clearance missing so far. */
+};
+
+/*!
+ * \brief Note a shortfall if \p d2, a squared distance, is less than
+ * \p keep.
+ */
+static void
+relax_check_gap (struct relax_check *c, double d2, double keep)
+{
+  if (d2 < keep * keep)
+    MAKEMAX (c->worst, keep - sqrt (d2));
+}
+
+/*!
+ * \brief Whether the line being checked ends on the segment a-b of the
+ * given half width, i.e. is connected to it rather than in its way.
+ */
+static bool
+relax_check_ends_on (struct relax_check *c, double ax, double ay, double bx,
+  double by, double half)
+{
+  LineType *l = c->line;
+
+  return point_seg_dist2 (l->Point1.X, l->Point1.Y, ax, ay, bx, by)
+      <= half * half
+    || point_seg_dist2 (l->Point2.X, l->Point2.Y, ax, ay, bx, by)
+      <= half * half;
+}
+
+/*!
+ * \brief The distance the line being checked has to keep from a line of
+ * \p thickness and \p clearance: the wider of the two gaps.
+ */
+static double
+relax_check_keep (struct relax_check *c, Coord thickness, Coord clearance)
+{
+  return (c->line->Thickness + thickness) / 2.0
+    + MAX (c->line->Clearance, clearance) / 2.0;
+}
+
+/*!
+ * \brief Another line, unless it is the same trace: made for the same
+ * trace, or with an end on the line being checked or the other way
+ * round.
+ */
+static void
+relax_check_other (struct relax_check *c, LineType *other, int index)
+{
+  LineType *l = c->line;
+  double half = l->Thickness / 2.0;
+
+  if (other == l || ptrset_contains (&c->plan->gone, other))
+    return;
+  if (index >= c->first && c->groups[index - c->first] == c->group)
+    return;
+  if (relax_check_ends_on (c, other->Point1.X, other->Point1.Y,
+      other->Point2.X, other->Point2.Y, other->Thickness / 2.0)
+    || point_seg_dist2 (other->Point1.X, other->Point1.Y, l->Point1.X,
+      l->Point1.Y, l->Point2.X, l->Point2.Y) <= half * half
+    || point_seg_dist2 (other->Point2.X, other->Point2.Y, l->Point1.X,
+      l->Point1.Y, l->Point2.X, l->Point2.Y) <= half * half)
+    return;
+  relax_check_gap (c, seg_seg_dist2 (l->Point1.X, l->Point1.Y, l->Point2.X,
+    l->Point2.Y, other->Point1.X, other->Point1.Y, other->Point2.X,
+    other->Point2.Y), relax_check_keep (c, other->Thickness,
+    other->Clearance));
+}
+
+static int
+relax_check_line_callback (const BoxType *targ, void *private)
+{
+  relax_check_other (private, (LineType *) targ, -1);
+  return 1;
+}
+
+/*!
+ * \brief Pins and vias, taken as round; square and octagonal ones as
+ * the circle around them.
+ */
+static int
+relax_check_pin_callback (const BoxType *targ, void *private)
+{
+  struct relax_check *c = private;
+  PinType *pin = (PinType *) targ;
+  LineType *l = c->line;
+  double half = pin->Thickness / 2.0;
+
+  if (TEST_FLAG (SQUAREFLAG | OCTAGONFLAG, pin))
+    half *= M_SQRT2;
+  if (relax_check_ends_on (c, pin->X, pin->Y, pin->X, pin->Y, half))
+    return 1;
+  relax_check_gap (c, point_seg_dist2 (pin->X, pin->Y, l->Point1.X,
+    l->Point1.Y, l->Point2.X, l->Point2.Y),
+    relax_check_keep (c, 2 * half, pin->Clearance));
+  return 1;
+}
+
+/*!
+ * \brief Pads on the side of the board the layer is on.  Square ones
+ * are taken as round ended ones reaching their corners.
+ */
+static int
+relax_check_pad_callback (const BoxType *targ, void *private)
+{
+  struct relax_check *c = private;
+  PadType *pad = (PadType *) targ;
+  LineType *l = c->line;
+  double half = pad->Thickness / 2.0;
+
+  if (!(TEST_FLAG (ONSOLDERFLAG, pad) ? c->bottom : c->top))
+    return 0;
+  if (TEST_FLAG (SQUAREFLAG, pad))
+    half *= M_SQRT2;
+  if (relax_check_ends_on (c, pad->Point1.X, pad->Point1.Y, pad->Point2.X,
+    pad->Point2.Y, half))
+    return 1;
+  relax_check_gap (c, seg_seg_dist2 (l->Point1.X, l->Point1.Y, l->Point2.X,
+    l->Point2.Y, pad->Point1.X, pad->Point1.Y, pad->Point2.X,
+    pad->Point2.Y), relax_check_keep (c, 2 * half, pad->Clearance));
+  return 1;
+}
+
+/*!
+ * \brief Arcs, as the lines following them, allowing for how far those
+ * stray from the arc.
+ */
+static int
+relax_check_arc_callback (const BoxType *targ, void *private)
+{
+  struct relax_check *c = private;
+  ArcType *arc = (ArcType *) targ;
+  struct arccache_entry *e;
+  LineType *l = c->line, *seg;
+  double half = arc->Thickness / 2.0, sag;
+  int i;
+
+  if (ptrset_contains (&c->plan->gone, arc)
+    || relax_check_ends_on (c, arc->Point1.X, arc->Point1.Y,
+      arc->Point1.X, arc->Point1.Y, half)
+    || relax_check_ends_on (c, arc->Point2.X, arc->Point2.Y,
+      arc->Point2.X, arc->Point2.Y, half))
+    return 0;
+  e = arccache_get (&c->arcs, arc, JOSTLE_ARC_TOLERANCE);
+  sag = MAX (arc->Width, arc->Height) * (1 - cos (fabs ((double) arc->Delta)
+    * M_PI / 360.0 / e->segs_n));
+  for (i = 0; i < e->segs_n; i++)
+  {
+    seg = &e->segs[i].line;
+    relax_check_gap (c, seg_seg_dist2 (l->Point1.X, l->Point1.Y,
+      l->Point2.X, l->Point2.Y, seg->Point1.X, seg->Point1.Y,
+      seg->Point2.X, seg->Point2.Y),
+      relax_check_keep (c, arc->Thickness, arc->Clearance) + sag);
+  }
+  return 1;
+}
+
+/*!
+ * \brief Check the line plan->lines[\p index], made by the relaxation.
+ */
+static void
+relax_check_line (struct relax_check *c, int index)
+{
+  struct jostle_plan *plan = c->plan;
+  LineType *l = plan->lines[index];
+  int i;
+
+  if (ptrset_contains (&plan->gone, l))
+    return;
+  c->line = l;
+  c->group = c->groups[index - c->first];
+  relax_check_gap (c, point_seg_dist2 (c->rx->cx, c->rx->cy, l->Point1.X,
+    l->Point1.Y, l->Point2.X, l->Point2.Y),
+    c->rx->radius + l->Thickness / 2.0);
+  r_search (plan->layer->line_tree, &l->BoundingBox, NULL,
+    relax_check_line_callback, c);
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    if (box_overlap (&plan->lines[i]->BoundingBox, &l->BoundingBox))
+      relax_check_other (c, plan->lines[i], i);
+  }
+  if (plan->layer->arc_tree)
+    r_search (plan->layer->arc_tree, &l->BoundingBox, NULL,
+      relax_check_arc_callback, c);
+  if (PCB->Data->via_tree)
+    r_search (PCB->Data->via_tree, &l->BoundingBox, NULL,
+      relax_check_pin_callback, c);
+  if (PCB->Data->pin_tree)
+    r_search (PCB->Data->pin_tree, &l->BoundingBox, NULL,
+      relax_check_pin_callback, c);
+  if (PCB->Data->pad_tree && (c->top || c->bottom))
+    r_search (PCB->Data->pad_tree, &l->BoundingBox, NULL,
+      relax_check_pad_callback, c);
+}
+
+/*!
+ * \brief An end of one of the lines collected for a relaxation.
+ */
+struct relax_end
+{
+  Coord x, y;
+  int line, end;
+};
+
+static int
+relax_end_compare (const void *va, const void *vb)
+{
+  const struct relax_end *a = va, *b = vb;
+
+  if (a->x != b->x)
+    return a->x < b->x ? -1 : 1;
+  if (a->y != b->y)
+    return a->y < b->y ? -1 : 1;
+  return a->line - b->line;
+}
+
+static int
+relax_anchor_callback (const BoxType *targ, void *private)
+{
+  *(bool *) private = true;
+  return 1;
+}
+
+/*!
+ * \brief Whether a pin, pad, via or arc is at (x, y), so that lines
+ * ending there have to stay put.
+ */
+static bool
+relax_anchored (struct jostle_plan *plan, Coord x, Coord y)
+{
+  BoxType box;
+  bool found = false;
+
+  box.X1 = x;
+  box.Y1 = y;
+  box.X2 = x + 1;
+  box.Y2 = y + 1;
+  if (PCB->Data->via_tree)
+    r_search (PCB->Data->via_tree, &box, NULL, relax_anchor_callback, &found);
+  if (!found && PCB->Data->pin_tree)
+    r_search (PCB->Data->pin_tree, &box, NULL, relax_anchor_callback, &found);
+  if (!found && PCB->Data->pad_tree)
+    r_search (PCB->Data->pad_tree, &box, NULL, relax_anchor_callback, &found);
+  if (!found && plan->layer->arc_tree)
+    r_search (plan->layer->arc_tree, &box, NULL, relax_anchor_callback,
+      &found);
+  return found;
+}
+
+/*!
+ * \brief The node at one end of a run, and its neighbour, unless that
+ * end is outside the window.
+ */
+static bool
+relax_run_end (struct relax *rx, int run, int end, int *node, int *next)
+{
+  struct relax_trace *t;
+
+  if (run < 0)
+    return false;
+  t = &rx->traces[run];
+  if (end == 0 ? t->head : t->tail)
+    return false;
+  *node = end == 0 ? t->first : t->first + t->n - 1;
+  *next = end == 0 ? *node + 1 : *node - 1;
+  return true;
+}
+
+/*!
+ * \brief Make the nodes for the lines collected, joining lines that
+ * meet end to end into traces.
+ *
+ * Where exactly two lines meet and nothing else is, their end nodes
+ * move as one.  Every other end stays put: where a trace ends, branches
+ * or meets a pin, pad, via or arc.
+ */
+static void
+relax_add_lines (struct relax *rx, struct jostle_plan *plan,
+  struct relax_collect *rc, double spacing)
+{
+  struct relax_end *ends, *e;
+  struct relax_joint *jt;
+  int n = rc->lines_n, i, j, k, a, na, b, nb;
+  int *parent, *run, *pairs, pairs_n = 0;
+  bool *fixed, ok;
+  size_t size;
+
+  if (n <= 0)
+    return;
+  size = (size_t) n;
+  ends = (struct relax_end *) malloc (2 * size * sizeof (struct relax_end));
+  parent = (int *) malloc (size * sizeof (int));
+  run = (int *) malloc (size * sizeof (int));
+  pairs = (int *) malloc (size * sizeof (int));
+  fixed = (bool *) calloc (2 * size, sizeof (bool));
+  for (i = 0; i < n; i++)
+  {
+    parent[i] = i;
+    for (k = 0; k < 2; k++)
+    {
+      e = &ends[2 * i + k];
+      e->x = k ? rc->lines[i]->Point2.X : rc->lines[i]->Point1.X;
+      e->y = k ? rc->lines[i]->Point2.Y : rc->lines[i]->Point1.Y;
+      e->line = i;
+      e->end = k;
+    }
+  }
+  qsort (ends, 2 * n, sizeof (struct relax_end), relax_end_compare);
+  for (i = 0; i < 2 * n; i = j)
+  {
+    for (j = i + 1; j < 2 * n && ends[j].x == ends[i].x
+      && ends[j].y == ends[i].y; j++)
+      ;
+    if (j - i == 2 && ends[i].line != ends[i + 1].line
+      && !relax_anchored (plan, ends[i].x, ends[i].y))
+    {
+      parent[union_find (parent, ends[i].line)] =
+        union_find (parent, ends[i + 1].line);
+      pairs[pairs_n++] = i;
+      continue;
+    }
+    for (k = i; k < j; k++)
+      fixed[2 * ends[k].line + ends[k].end] = true;
+  }
+  for (i = 0; i < n; i++)
+  {
+    run[i] = relax_add_line (rx, rc->lines[i], spacing,
+      union_find (parent, i), fixed[2 * i], fixed[2 * i + 1]);
+  }
+  for (i = 0; i < pairs_n; i++)
+  {
+    e = &ends[pairs[i]];
+    ok = relax_run_end (rx, run[e[0].line], e[0].end, &a, &na);
+    if (relax_run_end (rx, run[e[1].line], e[1].end, &b, &nb) && ok)
+    {
+      rx->joints = (struct relax_joint *) grow_array (rx->joints,
+        rx->joints_n, &rx->joints_max, sizeof (struct relax_joint));
+      jt = &rx->joints[rx->joints_n++];
+      jt->a = a;
+      jt->na = na;
+      jt->b = b;
+      jt->nb = nb;
+      continue;
+    }
+    /* one of them is cut off by the window, hold the other */
+    if (ok)
+      rx->fixed[a] = true;
+    if (relax_run_end (rx, run[e[1].line], e[1].end, &b, &nb))
+      rx->fixed[b] = true;
+  }
+  free (ends);
+  free (parent);
+  free (run);
+  free (pairs);
+  free (fixed);
+}
+
+/*!
+ * \brief Plan pushing lines out of a round brush by relaxation: every
+ * trace near the brush bends at once, keeping its distance from the
+ * brush and from the others, then is snapped back to 45 degrees.
+ *
+ * The window of traces taken into account grows as long as moved
+ * traces come near traces outside it.  What clearance the new lines
+ * still miss, to the brush, to each other and to the lines, arcs, pins,
+ * pads and vias on the board, goes in the plan's stats.
+ */
+static void
+jostle_relax_brush (struct jostle_plan *plan, Coord x, Coord y, Coord diameter)
+{
+  struct relax rx;
+  struct relax_collect rc;
+  struct relax_check check;
+  double spacing, moved, eps, thick, clear, left = 0;
+  int i, j, k, grow, group;
+  bool fresh, *bent;
+  BoxType box;
+
+  memset (&rc, 0, sizeof (rc));
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    CLEAR_FLAG (DRCFLAG, plan->lines[i]);
+  }
+  memset (&rx, 0, sizeof (rx));
+  rx.window.X1 = x - 2 * diameter;
+  rx.window.Y1 = y - 2 * diameter;
+  rx.window.X2 = x + 2 * diameter;
+  rx.window.Y2 = y + 2 * diameter;
+  for (grow = 0; grow < RELAX_GROW; grow++)
+  {
+    box = rx.window;
+    relax_free (&rx);
+    rx.window = box;
+    rx.cx = x;
+    rx.cy = y;
+    rx.radius = diameter / 2.0;
+    relax_collect (plan, &rx.window, &rc);
+    if (rc.lines_n == 0)
+      break;
+    /* nodes closer than any two traces may come */
+    spacing = diameter / 4.0;
+    thick = clear = 0;
+    for (i = 0; i < rc.lines_n; i++)
+    {
+      MAKEMIN (spacing, MAX ((rc.lines[i]->Thickness
+        + rc.lines[i]->Clearance) / 2.0, 1000));
+      MAKEMAX (thick, rc.lines[i]->Thickness);
+      MAKEMAX (clear, rc.lines[i]->Clearance);
+    }
+    rx.reach = MAX (thick + clear / 2, 1);
+    relax_add_lines (&rx, plan, &rc, spacing);
+    left = relax_solve (&rx, plan);
+    /* did anything move up to a trace we did not know of? */
+    fresh = false;
+    for (i = 0; i < rx.n && !fresh; i++)
+    {
+      moved = hypot (rx.x[i] - rx.ox[i], rx.y[i] - rx.oy[i]);
+      if (moved < 1)
+        continue;
+      box.X1 = rx.x[i] - rx.reach;
+      box.Y1 = rx.y[i] - rx.reach;
+      box.X2 = rx.x[i] + rx.reach;
+      box.Y2 = rx.y[i] + rx.reach;
+      if (box.X1 < rx.window.X1 || box.Y1 < rx.window.Y1
+        || box.X2 > rx.window.X2 || box.Y2 > rx.window.Y2)
+        fresh = true;
+    }
+    if (!fresh || grow == RELAX_GROW - 1)
+      break;
+    /* widen the window and start over */
+    rx.window.X1 -= diameter * 2;
+    rx.window.Y1 -= diameter * 2;
+    rx.window.X2 += diameter * 2;
+    rx.window.Y2 += diameter * 2;
+  }
+  box_grow (&plan->looked, &rx.window);
+  /* replace only the traces that moved, all their lines at once so
+   * they stay joined
+   */
+  eps = MAX (rx.reach / 8, 100);
+  bent = (bool *) calloc (MAX (rc.lines_n, 1), sizeof (bool));
+  for (i = 0; i < rx.n; i++)
+  {
+    if (hypot (rx.x[i] - rx.ox[i], rx.y[i] - rx.oy[i]) >= eps)
+      bent[rx.group[i]] = true;
+  }
+  memset (&check, 0, sizeof (check));
+  check.plan = plan;
+  check.rx = &rx;
+  check.first = plan->lines_n;
+  for (j = 0; j < rx.traces_n; j++)
+  {
+    if (!bent[rx.traces[j].group])
+      continue;
+    k = plan->lines_n;
+    relax_emit (&rx, plan, &rx.traces[j], eps);
+    check.groups = (int *) realloc (check.groups,
+      MAX (plan->lines_n - check.first, 1) * sizeof (int));
+    for (; k < plan->lines_n; k++)
+      check.groups[k - check.first] = rx.traces[j].group;
+  }
+  /* the nodes were kept apart; now see what the lines between them
+   * come near, and report that instead
+   */
+  if (plan->lines_n > check.first)
+  {
+    group = GetLayerGroupNumberByNumber (GetLayerNumber (PCB->Data,
+      plan->layer));
+    check.top = group == GetLayerGroupNumberBySide (TOP_SIDE);
+    check.bottom = group == GetLayerGroupNumberBySide (BOTTOM_SIDE);
+    for (k = check.first; k < plan->lines_n; k++)
+      relax_check_line (&check, k);
+    left = check.worst;
+    arccache_free (&check.arcs);
+  }
+  free (check.groups);
+  if (left >= 1)
+    MAKEMAX (plan->stats.relax_left, left);
+  free (bent);
+  free (rc.lines);
+  relax_free (&rx);
+}
+
+/*!
+ * \brief One selected via to jostle around.
+ */
+struct jostle_via
+{
+  Coord x, y;
+  Coord diameter;
+};
+
+/*!
+ * \brief Vias whose jostles may affect each other, so they are planned
+ * one after the other.
+ */
+struct jostle_group
+{
+  int *vias;
+    /*!< indices into the via list, in selection order. */
+  int vias_n;
+  struct jostle_plan plan;
+  bool planned;
+};
+
+/*!
+ * \brief Work shared between the planning threads.
+ */
+struct jostle_batch
+{
+  struct jostle_via *via;
+  int via_n, via_max;
+  struct jostle_group *group;
+  int group_n;
+  int next;
+    /*!< next group to be picked up by a worker. */
+  pthread_mutex_t lock;
+  struct jostle_stats stats;
+    /*!< of all the plans made, including those merged and made again. */
+  bool relax;
+    /*!< plan with jostle_relax_brush() instead. */
+};
+
+static void
+jostle_plan_group (struct jostle_batch *batch, struct jostle_group *g)
+{
+  int i;
+
+  for (i = 0; i < g->vias_n; i++)
+  {
+    struct jostle_via *v = &batch->via[g->vias[i]];
+
+    if (batch->relax)
+      jostle_relax_brush (&g->plan, v->x, v->y, v->diameter);
+    else
+      jostle_plan_brush (&g->plan, v->x, v->y, v->diameter);
+  }
+  g->planned = true;
+}
+
+static void *
+jostle_plan_worker (void *private)
+{
+  struct jostle_batch *batch = private;
+  int i;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&batch->lock);
+    while (batch->next < batch->group_n && batch->group[batch->next].planned)
+      batch->next++;
+    i = batch->next++;
+    pthread_mutex_unlock (&batch->lock);
+    if (i >= batch->group_n)
+      return NULL;
+    jostle_plan_group (batch, &batch->group[i]);
+  }
+}
+
+/*!
+ * \brief Plan every group not planned yet, on as many threads as there
+ * are processors.
+ *
+ * Planning only reads the board, and nothing else changes it while
+ * the workers run.
+ */
+static void
+jostle_plan_groups (struct jostle_batch *batch)
+{
+  pthread_t *threads;
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  int i, todo = 0, n;
+
+  for (i = 0; i < batch->group_n; i++)
+  {
+    if (!batch->group[i].planned)
+      todo++;
+  }
+  n = MIN (cpus > 0 ? cpus : 1, todo);
+  batch->next = 0;
+  if (n <= 1)
+  {
+    jostle_plan_worker (batch);
+    return;
+  }
+  threads = (pthread_t *) malloc (n * sizeof (pthread_t));
+  for (i = 0; i < n; i++)
+  {
+    if (pthread_create (&threads[i], NULL, jostle_plan_worker, batch) != 0)
+      break;
+  }
+  /* if threads could not be started, this thread does the rest */
+  if (i == 0)
+    jostle_plan_worker (batch);
+  while (i-- > 0)
+    pthread_join (threads[i], NULL);
+  free (threads);
+}
+
+/*!
+ * \brief Two plans get in each other's way if they are on the same
+ * layer and one changes anything the other looked at, or both change the
+ * same area.
+ */
+static bool
+jostle_plans_interact (struct jostle_plan *a, struct jostle_plan *b)
+{
+  if (a->layer != b->layer)
+  {
+    /* lines on other layers are never looked at */
+    return false;
+  }
+  return box_overlap (&a->touched, &b->looked)
+    || box_overlap (&b->touched, &a->looked)
+    || box_overlap (&a->touched, &b->touched);
+}
+
+static int
+int_compare (const void *va, const void *vb)
+{
+  return *(const int *) va - *(const int *) vb;
+}
+
+/*!
+ * \brief Merge groups whose plans interact, so they get planned again
+ * one after the other.  Returns false if all plans are independent.
+ */
+static bool
+jostle_merge_groups (struct jostle_batch *batch)
+{
+  struct jostle_group *merged, *g, *m;
+  int *parent, *slot, *members;
+  int i, j, root, n = 0;
+  bool any = false;
+
+  parent = (int *) malloc (batch->group_n * sizeof (int));
+  for (i = 0; i < batch->group_n; i++)
+    parent[i] = i;
+  for (i = 0; i < batch->group_n; i++)
+  {
+    for (j = i + 1; j < batch->group_n; j++)
+    {
+      if (union_find (parent, i) != union_find (parent, j)
+        && jostle_plans_interact (&batch->group[i].plan, &batch->group[j].plan))
+      {
+        parent[union_find (parent, j)] = union_find (parent, i);
+        any = true;
+      }
+    }
+  }
+  if (!any)
+  {
+    free (parent);
+    return false;
+  }
+  slot = (int *) malloc (batch->group_n * sizeof (int));
+  members = (int *) calloc (batch->group_n, sizeof (int));
+  merged = (struct jostle_group *) calloc (batch->group_n, sizeof (struct jostle_group));
+  for (i = 0; i < batch->group_n; i++)
+    slot[i] = -1;
+  for (i = 0; i < batch->group_n; i++)
+  {
+    g = &batch->group[i];
+    root = union_find (parent, i);
+    if (slot[root] < 0)
+    {
+      slot[root] = n++;
+      merged[slot[root]].vias = (int *) malloc (batch->via_n * sizeof (int));
+    }
+    m = &merged[slot[root]];
+    members[slot[root]]++;
+    memcpy (m->vias + m->vias_n, g->vias, g->vias_n * sizeof (int));
+    m->vias_n += g->vias_n;
+  }
+  for (i = 0; i < batch->group_n; i++)
+  {
+    g = &batch->group[i];
+    m = &merged[slot[union_find (parent, i)]];
+    if (members[m - merged] == 1)
+    {
+      /* on its own, its plan still holds */
+      m->plan = g->plan;
+      m->planned = true;
+    }
+    else
+    {
+      jostle_stats_add (&batch->stats, &g->plan.stats);
+      jostle_plan_free (&g->plan);
+      jostle_plan_init (&m->plan, g->plan.layer);
+      qsort (m->vias, m->vias_n, sizeof (int), int_compare);
+    }
+    free (g->vias);
+  }
+  free (batch->group);
+  batch->group = merged;
+  batch->group_n = n;
+  free (members);
+  free (slot);
+  free (parent);
+  return true;
+}
+
+/*!
+ * \brief Jostle around every brush in \p batch, on every layer in
+ * \p layers.
+ *
+ * Each brush on each layer is planned on its own first, all at the same
+ * time.  Brushes whose plans turn out to get in each other's way on a
+ * layer are grouped and planned again, one after the other within the
+ * group, until all groups are independent.  Then everything is applied
+ * in one go.
+ */
+static void
+jostle_run (struct jostle_batch *batch, LayerType **layers, int layer_n)
+{
+  struct jostle_group *g;
+  double start;
+  int i, l;
+
+  batch->group_n = batch->via_n * layer_n;
+  batch->group = (struct jostle_group *) calloc (batch->group_n,
+    sizeof (struct jostle_group));
+  for (l = 0; l < layer_n; l++)
+  {
+    LINE_LOOP (layers[l]);
+    {
+      CLEAR_FLAG (DRCFLAG, line);
+    }
+    END_LOOP;
+    for (i = 0; i < batch->via_n; i++)
+    {
+      g = &batch->group[l * batch->via_n + i];
+      g->vias = (int *) malloc (sizeof (int));
+      g->vias[0] = i;
+      g->vias_n = 1;
+      jostle_plan_init (&g->plan, layers[l]);
+    }
+  }
+  pthread_mutex_init (&batch->lock, NULL);
+  start = jostle_now ();
+  do
+  {
+    jostle_plan_groups (batch);
+  } while (jostle_merge_groups (batch));
+  batch->stats.plan_time += jostle_now () - start;
+  pthread_mutex_destroy (&batch->lock);
+  start = jostle_now ();
+  for (i = 0; i < batch->group_n; i++)
+  {
+    jostle_apply_plan (&batch->group[i].plan);
+    jostle_stats_add (&batch->stats, &batch->group[i].plan.stats);
+    jostle_plan_free (&batch->group[i].plan);
+    free (batch->group[i].vias);
+  }
+  batch->stats.apply_time += jostle_now () - start;
+  free (batch->group);
+}
+
+static void
+jostle_add_brush (struct jostle_batch *batch, Coord x, Coord y, Coord diameter)
+{
+  batch->via = (struct jostle_via *) grow_array (batch->via, batch->via_n,
+    &batch->via_max, sizeof (struct jostle_via));
+  batch->via[batch->via_n].x = x;
+  batch->via[batch->via_n].y = y;
+  batch->via[batch->via_n].diameter = diameter;
+  batch->via_n++;
+}
+
+/*!
+ * \brief Collect the copper layers of a list of layer groups such as
+ * "1:3", numbered from 1 like in the layer group setting, each layer
+ * once.  \p layers has room for MAX_LAYER.
+ */
+static int
+jostle_group_layers (const char *list, LayerType **layers)
+{
+  const char *s = list;
+  char *end;
+  int group, n = 0;
+  bool seen[MAX_LAYER];
+
+  memset (seen, 0, sizeof (seen));
+  while (*s)
+  {
+    group = strtol (s, &end, 10) - 1;
+    if (end == s || group < 0 || group >= max_group)
+    {
+      return -1;
+    }
+    GROUP_LOOP (PCB->Data, group);
+    {
+      if (number < MAX_LAYER && !seen[number] && n < MAX_LAYER)
+      {
+        seen[number] = true;
+        layers[n++] = layer;
+      }
+    }
+    END_LOOP;
+    s = end;
+    while (*s == ':' || *s == ' ')
+      s++;
+  }
+  return n;
+}
+
+/*!
+ * \brief A jostle planned in the background for the preview, against a
+ * private copy of the layer's lines.
+ *
+ * The board may change, or the crosshair move on, while the worker
+ * plans.  A job that is no longer wanted is cancelled and left to clean
+ * up after itself.
+ */
+struct jostle_job
+{
+  Coord x, y, diameter;
+  LayerType *layer;
+    /*!< the board layer the job was planned for. */
+  LayerType snapshot;
+    /*!< stands in for 'layer' while planning; only has the line and
+     * arc trees.
+     */
+  LineType *copies;
+  LineType **orig;
+    /*!< the board line each copy was made from. */
+  int copies_n;
+  ArcType *arc_copies;
+  ArcType **arc_orig;
+  int arc_copies_n;
+  struct jostle_plan plan;
+  volatile int cancel;
+  bool done;
+    /*!< the worker has finished, protected by jostle_job_lock. */
+};
+
+static pthread_mutex_t jostle_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \brief The preview, see JostlePreview().
+ */
+static struct
+{
+  bool on;
+  hidval timer;
+  Coord diameter;
+  struct jostle_job *job;
+    /*!< the newest job, running or done. */
+  bool drawn;
+    /*!< the job's plan is on the screen. */
+  hidGC gc;
+} jostle_preview_state;
+
+static const char jostle_preview_syntax[] =
+  "JostlePreview([On|Off|Toggle][, diameter])";
+
+static struct jostle_job *
+jostle_job_new (LayerType *layer, Coord x, Coord y, Coord diameter)
+{
+  struct jostle_job *job;
+  const BoxType **boxes;
+  int i = 0;
+
+  job = (struct jostle_job *) calloc (1, sizeof (struct jostle_job));
+  job->x = x;
+  job->y = y;
+  job->diameter = diameter;
+  job->layer = layer;
+  job->copies = (LineType *) malloc (MAX (layer->LineN, 1) * sizeof (LineType));
+  job->orig = (LineType **) malloc (MAX (layer->LineN, 1) * sizeof (LineType *));
+  boxes = (const BoxType **) malloc (MAX (layer->LineN, 1) * sizeof (BoxType *));
+  LINE_LOOP (layer);
+  {
+    job->copies[i] = *line;
+    CLEAR_FLAG (DRCFLAG, &job->copies[i]);
+    job->orig[i] = line;
+    boxes[i] = &job->copies[i].BoundingBox;
+    i++;
+  }
+  END_LOOP;
+  job->copies_n = i;
+  job->snapshot.line_tree = r_create_tree (boxes, i, 0);
+  free (boxes);
+  i = 0;
+  job->arc_copies = (ArcType *) malloc (MAX (layer->ArcN, 1) * sizeof (ArcType));
+  job->arc_orig = (ArcType **) malloc (MAX (layer->ArcN, 1) * sizeof (ArcType *));
+  boxes = (const BoxType **) malloc (MAX (layer->ArcN, 1) * sizeof (BoxType *));
+  ARC_LOOP (layer);
+  {
+    job->arc_copies[i] = *arc;
+    job->arc_orig[i] = arc;
+    boxes[i] = &job->arc_copies[i].BoundingBox;
+    i++;
+  }
+  END_LOOP;
+  job->arc_copies_n = i;
+  job->snapshot.arc_tree = r_create_tree (boxes, i, 0);
+  free (boxes);
+  jostle_plan_init (&job->plan, &job->snapshot);
+  job->plan.cancel = &job->cancel;
+  return job;
+}
+
+static void
+jostle_job_free (struct jostle_job *job)
+{
+  jostle_plan_free (&job->plan);
+  r_destroy_tree (&job->snapshot.line_tree);
+  r_destroy_tree (&job->snapshot.arc_tree);
+  free (job->copies);
+  free (job->orig);
+  free (job->arc_copies);
+  free (job->arc_orig);
+  free (job);
+}
+
+static void *
+jostle_job_worker (void *private)
+{
+  struct jostle_job *job = private;
+  bool cancelled;
+  double start = jostle_now ();
+
+  jostle_plan_brush (&job->plan, job->x, job->y, job->diameter);
+  job->plan.stats.plan_time = jostle_now () - start;
+  pthread_mutex_lock (&jostle_job_lock);
+  cancelled = job->cancel;
+  job->done = true;
+  pthread_mutex_unlock (&jostle_job_lock);
+  if (cancelled)
+    jostle_job_free (job);
+  return NULL;
+}
+
+static void
+jostle_job_start (struct jostle_job *job)
+{
+  pthread_t thread;
+
+  if (pthread_create (&thread, NULL, jostle_job_worker, job) == 0)
+  {
+    pthread_detach (thread);
+    return;
+  }
+  jostle_job_worker (job);
+}
+
+/*!
+ * \brief Give up on a job; it is freed now if it is done, or else by
+ * its worker once that notices.
+ */
+static void
+jostle_job_cancel (struct jostle_job *job)
+{
+  bool done;
+
+  pthread_mutex_lock (&jostle_job_lock);
+  job->cancel = 1;
+  done = job->done;
+  pthread_mutex_unlock (&jostle_job_lock);
+  if (done)
+    jostle_job_free (job);
+}
+
+static bool
+jostle_job_done (struct jostle_job *job)
+{
+  bool done;
+
+  pthread_mutex_lock (&jostle_job_lock);
+  done = job->done;
+  pthread_mutex_unlock (&jostle_job_lock);
+  return done;
+}
+
+struct jostle_check
+{
+  LineType *line;
+  const LineType *copy;
+  bool same;
+  int count;
+};
+
+static int
+jostle_check_callback (const BoxType *targ, void *private)
+{
+  struct jostle_check *check = private;
+  LineType *line = (LineType *) targ;
+
+  check->count++;
+  if (line == check->line
+    && line->Point1.X == check->copy->Point1.X
+    && line->Point1.Y == check->copy->Point1.Y
+    && line->Point2.X == check->copy->Point2.X
+    && line->Point2.Y == check->copy->Point2.Y
+    && line->Thickness == check->copy->Thickness
+    && line->Clearance == check->copy->Clearance)
+  {
+    check->same = true;
+  }
+  return 1;
+}
+
+struct jostle_arc_check
+{
+  ArcType *arc;
+  const ArcType *copy;
+  bool same;
+};
+
+static int
+jostle_arc_check_callback (const BoxType *targ, void *private)
+{
+  struct jostle_arc_check *check = private;
+  ArcType *arc = (ArcType *) targ;
+
+  if (arc == check->arc
+    && arc->X == check->copy->X && arc->Y == check->copy->Y
+    && arc->Width == check->copy->Width
+    && arc->Height == check->copy->Height
+    && arc->StartAngle == check->copy->StartAngle
+    && arc->Delta == check->copy->Delta
+    && arc->Thickness == check->copy->Thickness
+    && arc->Clearance == check->copy->Clearance)
+  {
+    check->same = true;
+  }
+  return 1;
+}
+
+static int
+jostle_count_callback (const BoxType *targ, void *private)
+{
+  (*(int *) private)++;
+  return 1;
+}
+
+/*!
+ * \brief Check that nothing the job looked at has changed on the board
+ * since the snapshot was taken.
+ */
+static bool
+jostle_job_current (struct jostle_job *job)
+{
+  struct jostle_check check;
+  int i, board = 0, snapshot = 0;
+
+  if (job->plan.looked.X1 > job->plan.looked.X2)
+  {
+    /* looked at nothing */
+    return true;
+  }
+  r_search (job->layer->line_tree, &job->plan.looked, NULL,
+    jostle_count_callback, &board);
+  for (i = 0; i < job->copies_n; i++)
+  {
+    if (!box_overlap (&job->copies[i].BoundingBox, &job->plan.looked))
+      continue;
+    snapshot++;
+    check.line = job->orig[i];
+    check.copy = &job->copies[i];
+    check.same = false;
+    check.count = 0;
+    r_search (job->layer->line_tree, &job->copies[i].BoundingBox, NULL,
+      jostle_check_callback, &check);
+    if (!check.same)
+      return false;
+  }
+  if (board != snapshot)
+    return false;
+  board = snapshot = 0;
+  if (job->layer->arc_tree)
+    r_search (job->layer->arc_tree, &job->plan.looked, NULL,
+      jostle_count_callback, &board);
+  for (i = 0; i < job->arc_copies_n; i++)
+  {
+    struct jostle_arc_check arc_check;
+
+    if (!box_overlap (&job->arc_copies[i].BoundingBox, &job->plan.looked))
+      continue;
+    snapshot++;
+    arc_check.arc = job->arc_orig[i];
+    arc_check.copy = &job->arc_copies[i];
+    arc_check.same = false;
+    r_search (job->layer->arc_tree, &job->arc_copies[i].BoundingBox, NULL,
+      jostle_arc_check_callback, &arc_check);
+    if (!arc_check.same)
+      return false;
+  }
+  return board == snapshot;
+}
+
+/*!
+ * \brief Draw, or with \p erase clear, the lines and arcs the preview
+ * would create.
+ */
+static void
+jostle_preview_draw (struct jostle_job *job, bool erase)
+{
+  struct jostle_plan *plan = &job->plan;
+  LineType *line;
+  ArcType *arc;
+  int i;
+
+  if (erase)
+  {
+    if (plan->touched.X1 <= plan->touched.X2)
+      gui->invalidate_lr (plan->touched.X1, plan->touched.X2,
+        plan->touched.Y1, plan->touched.Y2);
+    return;
+  }
+  if (jostle_preview_state.gc == NULL)
+  {
+    jostle_preview_state.gc = gui->graphics->make_gc ();
+  }
+  gui->graphics->set_color (jostle_preview_state.gc, PCB->ConnectedColor);
+  for (i = 0; i < plan->lines_n; i++)
+  {
+    line = plan->lines[i];
+    if (ptrset_contains (&plan->gone, line))
+      continue;
+    gui->graphics->set_line_width (jostle_preview_state.gc, line->Thickness);
+    gui->graphics->draw_line (jostle_preview_state.gc, line->Point1.X,
+      line->Point1.Y, line->Point2.X, line->Point2.Y);
+  }
+  for (i = 0; i < plan->arcs_n; i++)
+  {
+    arc = plan->arcs[i];
+    if (ptrset_contains (&plan->gone, arc))
+      continue;
+    gui->graphics->set_line_width (jostle_preview_state.gc, arc->Thickness);
+    gui->graphics->draw_arc (jostle_preview_state.gc, arc->X, arc->Y,
+      arc->Width, arc->Height, arc->StartAngle, arc->Delta);
+  }
+}
+
+/*!
+ * \brief Follow the crosshair: plan again whenever it moves, and show
+ * the plan once it is ready.
+ */
+static void
+jostle_preview_poll (hidval user)
+{
+  struct jostle_job *job = jostle_preview_state.job;
+
+  if (job && (job->x != Crosshair.X || job->y != Crosshair.Y
+    || job->layer != CURRENT || job->diameter != jostle_preview_state.diameter
+    || (jostle_job_done (job) && !jostle_job_current (job))))
+  {
+    if (jostle_preview_state.drawn)
+      jostle_preview_draw (job, true);
+    jostle_preview_state.drawn = false;
+    jostle_job_cancel (job);
+    job = NULL;
+  }
+  if (job == NULL)
+  {
+    job = jostle_job_new (CURRENT, Crosshair.X, Crosshair.Y,
+      jostle_preview_state.diameter);
+    jostle_preview_state.job = job;
+    jostle_job_start (job);
+  }
+  if (!jostle_preview_state.drawn && jostle_job_done (job))
+  {
+    jostle_preview_draw (job, false);
+    jostle_preview_state.drawn = true;
+  }
+  jostle_preview_state.timer = gui->add_timer (jostle_preview_poll, 50, user);
+}
+
+static void
+jostle_preview_stop (void)
+{
+  if (!jostle_preview_state.on)
+    return;
+  gui->stop_timer (jostle_preview_state.timer);
+  if (jostle_preview_state.job)
+  {
+    if (jostle_preview_state.drawn)
+      jostle_preview_draw (jostle_preview_state.job, true);
+    jostle_job_cancel (jostle_preview_state.job);
+  }
+  jostle_preview_state.job = NULL;
+  jostle_preview_state.drawn = false;
+  jostle_preview_state.on = false;
+}
+
+/*!
+ * \brief Take the previewed plan, if it is finished and is what jostling
+ * \p layer around (x, y) would do now.
+ *
+ * The plan is moved over to the board layer; free it with
+ * jostle_plan_free().  The preview starts planning afresh.
+ */
+static bool
+jostle_preview_take (LayerType *layer, Coord x, Coord y, Coord diameter,
+  struct jostle_plan *plan)
+{
+  struct jostle_job *job = jostle_preview_state.job;
+  int i;
+
+  if (!jostle_preview_state.on || job == NULL || !jostle_job_done (job)
+    || job->layer != layer || job->x != x || job->y != y
+    || job->diameter != diameter || !jostle_job_current (job))
+  {
+    return false;
+  }
+  *plan = job->plan;
+  plan->layer = layer;
+  plan->cancel = NULL;
+  for (i = 0; i < plan->removed_n; i++)
+  {
+    plan->removed[i] = job->orig[plan->removed[i] - job->copies];
+  }
+  for (i = 0; i < plan->removed_arcs_n; i++)
+  {
+    plan->removed_arcs[i] =
+      job->arc_orig[plan->removed_arcs[i] - job->arc_copies];
+  }
+  jostle_plan_init (&job->plan, &job->snapshot);
+  if (jostle_preview_state.drawn)
+    jostle_preview_draw (job, true);
+  jostle_preview_state.drawn = false;
+  jostle_job_cancel (job);
+  /* the board is about to change, plan again from the next snapshot */
+  jostle_preview_state.job = NULL;
+  return true;
+}
+
+/*!
+ * \brief JostlePreview([On|Off|Toggle][, diameter])
+ *
+ * While on, shows what Jostle() would do at the crosshair, planned in
+ * the background whenever the crosshair moves.  A Jostle() with the
+ * same diameter then uses the plan shown instead of planning again.
+ */
+static int
+jostle_preview (int argc, char **argv, Coord x, Coord y)
+{
+  bool rel, on = !jostle_preview_state.on;
+  hidval user;
+
+  if (argc > 0 && strcasecmp (argv[0], "On") == 0)
+    on = true;
+  else if (argc > 0 && strcasecmp (argv[0], "Off") == 0)
+    on = false;
+  else if (argc > 0 && strcasecmp (argv[0], "Toggle") != 0)
+  {
+    Message (_("ERROR: in JostlePreview, bad argument \"%s\".\n"), argv[0]);
+    return 1;
+  }
+  jostle_preview_stop ();
+  if (!on)
+    return 0;
+  if (argc == 3)
+    jostle_preview_state.diameter = GetValue (ARG(1), ARG(2), &rel);
+  else
+    jostle_preview_state.diameter = Settings.ViaThickness + (PCB->Bloat + 1) * 2 + 50;
+  jostle_preview_state.on = true;
+  user.ptr = NULL;
+  jostle_preview_poll (user);
+  return 0;
+}
+
+/*!
+ * \brief A drag in progress, see JostleDrag().
+ */
+static struct
+{
+  bool on;
+  hidval timer;
+  LayerType *layer;
+  Coord x, y;
+    /*!< where the corridor has been swept to so far. */
+  Coord diameter;
+  LineType **fresh;
+    /*!< lines the previous step made, still flagged DRCFLAG. */
+  int fresh_n, fresh_max;
+  struct jostle_stats stats;
+    /*!< of all the steps so far. */
+} jostle_drag_state;
+
+static const char jostle_drag_syntax[] =
+  "JostleDrag([Start|Stop][, diameter])";
+
+/*!
+ * \brief Jostle the strip of the corridor swept from the last position
+ * to (x, y).
+ *
+ * Everything before the strip has already been pushed aside, so only
+ * lines touching the strip itself are looked at.
+ */
+static void
+jostle_drag_step (Coord x, Coord y)
+{
+  struct jostle_plan plan;
+  LineType strip;
+  POLYAREA *brush;
+  double start;
+  int i;
+
+  /* lines the last step made may be in the way of this one */
+  for (i = 0; i < jostle_drag_state.fresh_n; i++)
+  {
+    CLEAR_FLAG (DRCFLAG, jostle_drag_state.fresh[i]);
+  }
+  jostle_drag_state.fresh_n = 0;
+  if (x == jostle_drag_state.x && y == jostle_drag_state.y)
+  {
+    brush = CirclePoly (x, y, jostle_drag_state.diameter / 2);
+  }
+  else
+  {
+    memset (&strip, 0, sizeof (strip));
+    strip.Point1.X = jostle_drag_state.x;
+    strip.Point1.Y = jostle_drag_state.y;
+    strip.Point2.X = x;
+    strip.Point2.Y = y;
+    strip.Thickness = jostle_drag_state.diameter;
+    brush = LinePoly (&strip, jostle_drag_state.diameter);
+  }
+  jostle_drag_state.x = x;
+  jostle_drag_state.y = y;
+  jostle_plan_init (&plan, jostle_drag_state.layer);
+  start = jostle_now ();
+  jostle_plan_poly (&plan, brush);
+  plan.stats.plan_time = jostle_now () - start;
+  start = jostle_now ();
+  jostle_apply_plan (&plan);
+  plan.stats.apply_time = jostle_now () - start;
+  for (i = 0; i < plan.created_n; i++)
+  {
+    jostle_drag_state.fresh = (LineType **) grow_array (jostle_drag_state.fresh,
+      jostle_drag_state.fresh_n, &jostle_drag_state.fresh_max,
+      sizeof (LineType *));
+    jostle_drag_state.fresh[jostle_drag_state.fresh_n++] = plan.created[i];
+  }
+  start = jostle_now ();
+  plan.stats.merged = jostle_coalesce (jostle_drag_state.layer,
+    &jostle_drag_state.fresh, &jostle_drag_state.fresh_n,
+    &jostle_drag_state.fresh_max);
+  plan.stats.merge_time = jostle_now () - start;
+  jostle_stats_add (&jostle_drag_state.stats, &plan.stats);
+  jostle_plan_free (&plan);
+  Draw ();
+}
+
+static void
+jostle_drag_poll (hidval user)
+{
+  if (Crosshair.X != jostle_drag_state.x || Crosshair.Y != jostle_drag_state.y)
+  {
+    jostle_drag_step (Crosshair.X, Crosshair.Y);
+  }
+  jostle_drag_state.timer = gui->add_timer (jostle_drag_poll, 20, user);
+}
+
+/*!
+ * \brief JostleDrag([Start|Stop][, diameter])
+ *
+ * Start pushes lines out of the way of a brush of the given diameter
+ * at the crosshair, and keeps doing so along the path the crosshair
+ * sweeps until Stop.  The whole drag is undone as one step.
+ */
+static int
+jostle_drag (int argc, char **argv, Coord x, Coord y)
+{
+  bool rel;
+  hidval user;
+
+  if (argc > 0 && strcasecmp (argv[0], "Stop") == 0)
+  {
+    if (!jostle_drag_state.on)
+      return 0;
+    gui->stop_timer (jostle_drag_state.timer);
+    jostle_drag_state.on = false;
+    free (jostle_drag_state.fresh);
+    jostle_drag_state.fresh = NULL;
+    jostle_drag_state.fresh_n = jostle_drag_state.fresh_max = 0;
+    if (jostle_drag_state.stats.merged)
+      Message (_("JostleDrag: merged away %d lines.\n"),
+        jostle_drag_state.stats.merged);
+    jostle_stats_record (&jostle_drag_state.stats);
+    SetChangedFlag (true);
+    IncrementUndoSerialNumber ();
+    return 0;
+  }
+  if (argc > 0 && strcasecmp (argv[0], "Start") != 0)
+  {
+    Message (_("ERROR: in JostleDrag, bad argument \"%s\".\n"), argv[0]);
+    return 1;
+  }
+  if (jostle_drag_state.on)
     return 0;
+  if (argc == 3)
+    jostle_drag_state.diameter = GetValue (ARG(1), ARG(2), &rel);
+  else
+    jostle_drag_state.diameter = Settings.ViaThickness + (PCB->Bloat + 1) * 2 + 50;
+  jostle_drag_state.layer = CURRENT;
+  LINE_LOOP (CURRENT);
+  {
+    CLEAR_FLAG (DRCFLAG, line);
+  }
+  END_LOOP;
+  jostle_drag_state.on = true;
+  memset (&jostle_drag_state.stats, 0, sizeof (struct jostle_stats));
+  jostle_drag_state.x = Crosshair.X;
+  jostle_drag_state.y = Crosshair.Y;
+  jostle_drag_step (Crosshair.X, Crosshair.Y);
+  user.ptr = NULL;
+  jostle_drag_state.timer = gui->add_timer (jostle_drag_poll, 20, user);
+  return 0;
+}
+
+static int
+jostle (int argc, char **argv, Coord x, Coord y)
+{
+  bool rel;
+  float value;
+  struct jostle_batch batch;
+  LayerType *layers[MAX_LAYER];
+  int layer_n = 1, l;
+  double start;
+  bool selected = false, relax = false;
+
+  layers[0] = CURRENT;
+  while (argc > 0)
+  {
+    if (strcasecmp (argv[0], "Selected") == 0)
+    {
+      selected = true;
+    }
+    else if (strcasecmp (argv[0], "Relax") == 0)
+    {
+      relax = true;
+    }
+    else if (strcasecmp (argv[0], "AllLayers") == 0)
+    {
+      for (layer_n = 0; layer_n < max_copper_layer; layer_n++)
+        layers[layer_n] = &PCB->Data->Layer[layer_n];
+    }
+    else if (strcasecmp (argv[0], "Groups") == 0 && argc > 1)
+    {
+      layer_n = jostle_group_layers (argv[1], layers);
+      if (layer_n <= 0)
+      {
+        Message (_("ERROR: in Jostle, bad layer group list \"%s\".\n"), argv[1]);
+        return 1;
+      }
+      argc--;
+      argv++;
+    }
+    else
+    {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc > 2)
+  {
+    Message (_("ERROR: in Jostle, usage: %s\n"), jostle_syntax);
+    return 1;
+  }
+  if (argc == 2)
+  {
+    value = GetValue (ARG(0), ARG(1), &rel);
+  }
+  else if (argc == 1)
+  {
+    value = GetValue (ARG(0), NULL, &rel); /* with any unit attached */
+  }
+  else if (selected)
+  {
+    value = 0; /* size of each via */
+  }
+  else
+  {
+    value = Settings.ViaThickness + (PCB->Bloat + 1) * 2 + 50;
+  }
+  memset (&batch, 0, sizeof (batch));
+  batch.relax = relax;
+  if (selected)
+  {
+    VIA_LOOP (PCB->Data);
+    {
+      if (TEST_FLAG (SELECTEDFLAG, via))
+        jostle_add_brush (&batch, via->X, via->Y, value ? value
+          : via->Thickness + (PCB->Bloat + 1) * 2 + 50);
+    }
+    END_LOOP;
+    if (batch.via_n == 0)
+    {
+      Message (_("Jostle: no vias selected.\n"));
+      return 0;
+    }
+  }
+  else
+  {
+    struct jostle_plan plan;
+
+    x = Crosshair.X;
+    y = Crosshair.Y;
+    JOSTLE_LOG ("%d, %d, %f\n", (int)x, (int)y, value);
+    if (layer_n == 1 && !relax
+      && jostle_preview_take (layers[0], x, y, (Coord) value, &plan))
+    {
+      /* already planned in the background */
+      LINE_LOOP (layers[0]);
+      {
+        CLEAR_FLAG (DRCFLAG, line);
+      }
+      END_LOOP;
+      start = jostle_now ();
+      jostle_apply_plan (&plan);
+      plan.stats.apply_time = jostle_now () - start;
+      jostle_stats_add (&batch.stats, &plan.stats);
+      jostle_plan_free (&plan);
+    }
+    else
+    {
+      jostle_add_brush (&batch, x, y, value);
+    }
+  }
+  if (batch.via_n > 0)
+  {
+    jostle_run (&batch, layers, layer_n);
+  }
+  free (batch.via);
+  start = jostle_now ();
+  for (l = 0; l < layer_n; l++)
+  {
+    batch.stats.merged += jostle_coalesce_layer (layers[l]);
+  }
+  batch.stats.merge_time = jostle_now () - start;
+  if (batch.stats.merged)
+  {
+    Message (_("Jostle: merged away %d lines.\n"), batch.stats.merged);
+  }
+  if (batch.stats.relax_left > 0)
+  {
+    char *gap = pcb_g_strdup_printf ("%$mS",
+      (Coord) ceil (batch.stats.relax_left));
+
+    Message (_("Jostle: relaxing left traces up to %s too close.\n"), gap);
+    g_free (gap);
+  }
+  jostle_stats_record (&batch.stats);
+  SetChangedFlag (true);
+  IncrementUndoSerialNumber ();
+  return 0;
+}
+
+#ifdef JOSTLE_RECORD
+
+static const char jostle_replay_syntax[] = "JostleReplay([Draw | File, name])";
+
+static hidGC jostle_replay_gc;
+
+static void
+jostle_replay_poly (POLYAREA *s, const char *color)
+{
+  POLYAREA *p = s;
+  PLINE *pl;
+  VNODE *v;
+
+  if (jostle_replay_gc == NULL)
+    jostle_replay_gc = gui->graphics->make_gc ();
+  gui->graphics->set_color (jostle_replay_gc, color);
+  gui->graphics->set_line_width (jostle_replay_gc, 1);
+  do
+  {
+    for (pl = p->contours; pl; pl = pl->next)
+    {
+      v = &pl->head;
+      do
+      {
+        gui->graphics->draw_line (jostle_replay_gc, v->point[0], v->point[1],
+          v->next->point[0], v->next->point[1]);
+      } while ((v = v->next) != &pl->head);
+    }
+  } while ((p = p->f) != s);
+}
+
+/*!
+ * \brief Draw the next recorded step, and come back for the one after
+ * it, instead of making the GUI wait.
+ */
+static void
+jostle_replay_next (hidval user)
+{
+  struct jostle_step *s;
+  int i;
+
+  pthread_mutex_lock (&jostle_recorder.lock);
+  while (jostle_recorder.replay > 0)
+  {
+    i = (jostle_recorder.next - jostle_recorder.replay + JOSTLE_RECORD_STEPS)
+      % JOSTLE_RECORD_STEPS;
+    jostle_recorder.replay--;
+    s = &jostle_recorder.step[i];
+    if (s->poly)
+    {
+      jostle_replay_poly (s->poly, jostle_step_colors[s->kind]);
+      break;
+    }
+    if (s->note)
+      Message ("%s", s->note);
+  }
+  if (jostle_recorder.replay > 0)
+    jostle_recorder.timer = gui->add_timer (jostle_replay_next, 250, user);
+  pthread_mutex_unlock (&jostle_recorder.lock);
+}
+
+static int
+jostle_replay_file (const char *name)
+{
+  struct jostle_step *s;
+  POLYAREA *p;
+  PLINE *pl;
+  VNODE *v;
+  FILE *f;
+  int i, n;
+
+  if ((f = fopen (name, "w")) == NULL)
+  {
+    Message (_("ERROR: in JostleReplay, cannot write \"%s\".\n"), name);
+    return 1;
+  }
+  pthread_mutex_lock (&jostle_recorder.lock);
+  for (n = jostle_recorder.count; n > 0; n--)
+  {
+    i = (jostle_recorder.next - n + JOSTLE_RECORD_STEPS) % JOSTLE_RECORD_STEPS;
+    s = &jostle_recorder.step[i];
+    fprintf (f, "step %s\n", jostle_step_names[s->kind]);
+    if (s->note)
+      fprintf (f, "%s", s->note);
+    if ((p = s->poly) == NULL)
+      continue;
+    do
+    {
+      for (pl = p->contours; pl; pl = pl->next)
+      {
+        fprintf (f, "contour %d\n", pl->Count);
+        v = &pl->head;
+        do
+        {
+          pcb_fprintf (f, "%mn %mn\n", v->point[0], v->point[1]);
+        } while ((v = v->next) != &pl->head);
+      }
+    } while ((p = p->f) != s->poly);
   }
-  poly_Free (&lp);
-  if (inside)
+  pthread_mutex_unlock (&jostle_recorder.lock);
+  fclose (f);
+  return 0;
+}
+
+/*!
+ * \brief JostleReplay([Draw | File, name])
+ *
+ * Shows the recorded steps of the last jostles over the board one at a
+ * time, or writes them to a file.
+ */
+static int
+jostle_replay (int argc, char **argv, Coord x, Coord y)
+{
+  hidval user;
+
+  if (argc > 1 && strcasecmp (argv[0], "File") == 0)
+    return jostle_replay_file (argv[1]);
+  if (argc > 0 && strcasecmp (argv[0], "Draw") != 0)
   {
-    // XXX not done!
-    // XXX if this is part of a series of lines passing
-    // XXX through, need to process as a group.
-    // XXX if it just ends in here, shorten it??
-    return 0;
+    Message (_("ERROR: in JostleReplay, bad argument \"%s\".\n"), argv[0]);
+    return 1;
   }
-  /*
-   * Cut the brush with the line to figure out which side to go
-   * around.  Use a very fine line.  XXX can still graze.
-   */
-  lp = LinePoly (line, 1);
-  if (!poly_M_Copy0 (&copy, info->brush))
+  pthread_mutex_lock (&jostle_recorder.lock);
+  if (jostle_recorder.replay > 0)
+    gui->stop_timer (jostle_recorder.timer);
+  jostle_recorder.replay = jostle_recorder.count;
+  pthread_mutex_unlock (&jostle_recorder.lock);
+  user.ptr = NULL;
+  jostle_replay_next (user);
+  return 0;
+}
+
+#endif
+
+/*!
+ * \brief JostleStats([Clear])
+ *
+ * Reports what the engine did in each of the last jostles, oldest
+ * first, or forgets them.
+ */
+static int
+jostle_stats (int argc, char **argv, Coord x, Coord y)
+{
+  struct jostle_stats *st;
+  int i;
+
+  if (argc > 0 && strcasecmp (argv[0], "Clear") == 0)
+  {
+    jostle_history.calls = 0;
     return 0;
-  r = poly_Boolean_free (copy, lp, &tmp, PBO_SUB);
-  if (r != err_ok)
+  }
+  if (jostle_history.calls == 0)
   {
-    pcb_fprintf (stderr, "Error while jostling PBO_SUB: %d\n", r);
+    Message (_("JostleStats: nothing jostled yet.\n"));
     return 0;
   }
-  if (tmp == tmp->f)
+  i = MAX (0, jostle_history.calls - JOSTLE_HISTORY);
+  for (; i < jostle_history.calls; i++)
   {
-    /* it didn't slice, must have glanced. intersect instead
-     * to get the glancing sliver??
-     */
-    pcb_fprintf (stderr, "try isect??\n");
-    lp = LinePoly (line, line->Thickness);
-    r = poly_Boolean_free (tmp, lp, &tmp, PBO_ISECT);
-    if (r != err_ok)
-    {
-      fprintf (stderr, "Error while jostling PBO_ISECT: %d\n", r);
-      return 0;
-    }
-    nocentroid = 1;
+    st = &jostle_history.call[i % JOSTLE_HISTORY];
+    Message (_("Jostle %d: %d iterations, %d search hits, %d touching tests, "
+        "prefilter rejected %d of %d lines, "
+        "booleans %d unite %d isect %d sub %d xor, "
+        "brush peak %d vertices, mean %.1f per iteration, "
+        "%d lines created, %d removed, %d merged away, "
+        "plan %.3f ms, apply %.3f ms, merge %.3f ms\n"),
+      i + 1, st->iterations, st->search_hits, st->touching_tests,
+      st->prefilter_rejects, st->prefilter_tests,
+      st->booleans[PBO_UNITE], st->booleans[PBO_ISECT],
+      st->booleans[PBO_SUB], st->booleans[PBO_XOR], st->peak_vertices,
+      st->brush_rounds ? (double) st->vertices / st->brush_rounds : 0.0,
+      st->created, st->removed, st->merged, st->plan_time * 1e3,
+      st->apply_time * 1e3, st->merge_time * 1e3);
   }
-  /* XXX if this operation did not create two chunks, bad things are about to happen */
-  if (! tmp)
-    return 0;
-  n = tmp;
-  small = big = tmp->contours->area;
-  do
+  return 0;
+}
+
+/*!
+ * \brief Lay down a bus of \p traces parallel lines \p pitch apart,
+ * centered on the board, horizontal or at 45 degrees.
+ *
+ * Widths are used in turn from \p widths.  The lines are not undoable.
+ */
+static void
+jostle_bench_bus (LayerType *layer, int traces, Coord pitch, bool diagonal,
+  Coord *widths, int widths_n)
+{
+  Coord cx = PCB->MaxWidth / 2, cy = PCB->MaxHeight / 2;
+  Coord length = 4 * traces * pitch, step, x1, y1, x2, y2, w;
+  FlagType flags = MakeFlags (CLEARLINEFLAG);
+  int i;
+
+  /* keep the traces 'pitch' apart measured square to them */
+  step = diagonal ? pitch * M_SQRT2 : pitch;
+  for (i = 0; i < traces; i++)
   {
-    pcb_fprintf (stderr, "\t\tarea %g, %ms,%ms %ms,%ms\n", n->contours->area, n->contours->xmin,n->contours->ymin, n->contours->xmax,n->contours->ymax);
-    if (n->contours->area <= small)
+    w = widths[i % widths_n];
+    x1 = cx - length / 2;
+    x2 = cx + length / 2;
+    y1 = y2 = cy + (i - traces / 2) * step;
+    if (diagonal)
     {
-      smallest = n;
-      small = n->contours->area;
-    }
-    if (n->contours->area >= big)
-    {
-      big = n->contours->area;
-    }
-  } while((n = n->f) != tmp);
-  if (line->Point1.X == line->Point2.X)
-  { /* | */
-    if (info->box.X2 - smallest->contours->xmax >
-      smallest->contours->xmin - info->box.X1)
-    {
-      side = WEST;
-    }
-    else
-    {
-      side = EAST;
+      y1 -= length / 2;
+      y2 += length / 2;
     }
+    CreateNewLineOnLayer (layer, x1, y1, x2, y2, w,
+      MAX (2 * (pitch - w), 0), flags);
   }
-  else if (line->Point1.Y == line->Point2.Y)
-  { /* - */
-    if (info->box.Y2 - smallest->contours->ymax >
-      smallest->contours->ymin - info->box.Y1)
-    {
-      side = NORTH;
-    }
-    else
-    {
-      side = SOUTH;
-    }
+}
+
+static void
+jostle_bench_clear (LayerType *layer)
+{
+  LINE_LOOP (layer);
+  {
+    DestroyObject (PCB->Data, LINE_TYPE, layer, line, line);
   }
-  else if ((line->Point1.X > line->Point2.X) ==
-    (line->Point1.Y > line->Point2.Y))
-  { /* \ */
-    if (info->box.X2 - smallest->contours->xmax >
-      smallest->contours->xmin - info->box.X1)
-    {
-      side = SOUTHWEST;
-    }
-    else
+  END_LOOP;
+}
+
+/*!
+ * \brief JostleBench(traces, pitch, Orthogonal|Diagonal, widths, points[, diameter[, file]])
+ *
+ * For each point of a points x points grid over a synthetic bus on the
+ * current layer, lays down a fresh bus and jostles there.  Writes one
+ * line of comma separated values per jostle to \p file, or to stdout,
+ * with the time taken, object growth and engine counters.
+ *
+ * Meant for an empty board in the batch GUI: the lines it lays down
+ * are destroyed without undo, and the undo list is cleared after, so it
+ * refuses to run if the current layer has lines already.
+ */
+static int
+jostle_bench (int argc, char **argv, Coord x, Coord y)
+{
+  struct jostle_batch batch;
+  LayerType *layer = CURRENT;
+  Coord pitch, diameter, widths[16], span, px, py;
+  int traces, points, widths_n = 0, i, j, before, booleans, k;
+  bool rel, diagonal;
+  double start;
+  const char *s;
+  char *end, width[32];
+  FILE *f = stdout;
+
+  if (argc < 5)
+  {
+    Message (_("ERROR: in JostleBench, usage: %s\n"), jostle_bench_syntax);
+    return 1;
+  }
+  traces = atoi (argv[0]);
+  pitch = GetValue (argv[1], NULL, &rel);
+  diagonal = strcasecmp (argv[2], "Diagonal") == 0;
+  for (s = argv[3]; *s && widths_n < 16; s = *end ? end + 1 : end)
+  {
+    end = strchr (s, ':');
+    if (end == NULL)
+      end = (char *) s + strlen (s);
+    snprintf (width, sizeof (width), "%.*s", (int) (end - s), s);
+    widths[widths_n] = GetValue (width, NULL, &rel);
+    if (widths[widths_n] > 0)
+      widths_n++;
+  }
+  points = atoi (argv[4]);
+  if (traces < 1 || pitch <= 0 || widths_n == 0 || points < 1)
+  {
+    Message (_("ERROR: in JostleBench, usage: %s\n"), jostle_bench_syntax);
+    return 1;
+  }
+  if (layer->LineN != 0)
+  {
+    Message (_("ERROR: in JostleBench, the current layer is not empty.\n"));
+    return 1;
+  }
+  diameter = argc > 5 ? GetValue (argv[5], NULL, &rel)
+    : Settings.ViaThickness + (PCB->Bloat + 1) * 2 + 50;
+  if (argc > 6 && (f = fopen (argv[6], "a")) == NULL)
+  {
+    Message (_("ERROR: in JostleBench, cannot write \"%s\".\n"), argv[6]);
+    return 1;
+  }
+  fseek (f, 0, SEEK_END);
+  if (ftell (f) <= 0)
+    fprintf (f, "traces,pitch_nm,angle,widths,x_nm,y_nm,diameter_nm,"
+      "lines_before,lines_after,iterations,search_hits,touching_tests,"
+      "booleans,peak_vertices,plan_ms,apply_ms,merge_ms\n");
+  /* the grid covers the middle of the bus, across its width */
+  span = traces * pitch;
+  for (i = 0; i < points; i++)
+  {
+    for (j = 0; j < points; j++)
     {
-      side = NORTHEAST;
+      jostle_bench_clear (layer);
+      jostle_bench_bus (layer, traces, pitch, diagonal, widths, widths_n);
+      px = PCB->MaxWidth / 2 - span / 2
+        + (points > 1 ? span * i / (points - 1) : span / 2);
+      py = PCB->MaxHeight / 2 - span / 2
+        + (points > 1 ? span * j / (points - 1) : span / 2);
+      if (diagonal)
+        py += px - PCB->MaxWidth / 2;
+      before = layer->LineN;
+      memset (&batch, 0, sizeof (batch));
+      jostle_add_brush (&batch, px, py, diameter);
+      jostle_run (&batch, &layer, 1);
+      free (batch.via);
+      start = jostle_now ();
+      batch.stats.merged = jostle_coalesce_layer (layer);
+      batch.stats.merge_time = jostle_now () - start;
+      jostle_stats_record (&batch.stats);
+      for (k = booleans = 0; k < JOSTLE_BOOLEAN_OPS; k++)
+        booleans += batch.stats.booleans[k];
+      fprintf (f, "%d,%d,%s,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,"
+        "%.3f,%.3f,%.3f\n", traces, (int) pitch,
+        diagonal ? "45" : "0", argv[3], (int) px, (int) py, (int) diameter,
+        before, (int) layer->LineN, batch.stats.iterations,
+        batch.stats.search_hits, batch.stats.touching_tests, booleans,
+        batch.stats.peak_vertices, batch.stats.plan_time * 1e3,
+        batch.stats.apply_time * 1e3, batch.stats.merge_time * 1e3);
     }
   }
+  jostle_bench_clear (layer);
+  ClearUndoList (true);
+  if (f != stdout)
+    fclose (f);
   else
-  { /* / */
-    if (info->box.X2 - smallest->contours->xmax >
-      smallest->contours->xmin - info->box.X1)
-    {
-      side = NORTHWEST;
-    }
-    else
-    {
-      side = SOUTHEAST;
-    }
+    fflush (f);
+  return 0;
+}
+
+/*!
+ * \brief A trial spot for a via, and what is in its way.
+ */
+struct viaspot
+{
+  double x, y, radius;
+  double gap;
+    /*!< how far the via keeps from everything else, half its
+     * clearance.
+     */
+  bool blocked;
+  struct arccache arcs;
+  double tolerance;
+    /*!< how far arc lines may stray from their arc. */
+  int probes, hits;
+};
+
+/*!
+ * \brief How far the middle of the via keeps from an object with
+ * \p clearance: the wider of the two gaps the via and the object ask
+ * for.
+ */
+static double
+viaspot_keep (struct viaspot *s, Coord clearance)
+{
+  return s->radius + MAX (clearance / 2.0, s->gap);
+}
+
+/*!
+ * \brief Block the spot if it is closer than \p keep to the rectangle
+ * from (x1, y1) to (x2, y2).
+ */
+static void
+viaspot_box (struct viaspot *s, double x1, double y1, double x2, double y2,
+  double keep)
+{
+  double dx = MAX (MAX (x1 - s->x, s->x - x2), 0);
+  double dy = MAX (MAX (y1 - s->y, s->y - y2), 0);
+
+  if (dx * dx + dy * dy < keep * keep)
+    s->blocked = true;
+}
+
+/*!
+ * \brief Block the spot if it is closer than \p keep to the segment
+ * from a to b.
+ */
+static void
+viaspot_segment (struct viaspot *s, PointType *a, PointType *b, double keep)
+{
+  if (point_seg_dist2 (s->x, s->y, a->X, a->Y, b->X, b->Y) < keep * keep)
+    s->blocked = true;
+}
+
+static int
+viaspot_line_callback (const BoxType *targ, void *private)
+{
+  LineType *line = (LineType *) targ;
+  struct viaspot *s = private;
+
+  s->hits++;
+  if (!s->blocked)
+    viaspot_segment (s, &line->Point1, &line->Point2,
+      viaspot_keep (s, line->Clearance) + line->Thickness / 2.0);
+  return 1;
+}
+
+static int
+viaspot_arc_callback (const BoxType *targ, void *private)
+{
+  ArcType *arc = (ArcType *) targ;
+  struct viaspot *s = private;
+  struct arccache_entry *e;
+  int i;
+
+  s->hits++;
+  if (s->blocked)
+    return 1;
+  e = arccache_get (&s->arcs, arc, s->tolerance);
+  for (i = 0; i < e->segs_n && !s->blocked; i++)
+    viaspot_segment (s, &e->segs[i].line.Point1, &e->segs[i].line.Point2,
+      viaspot_keep (s, arc->Clearance) + arc->Thickness / 2.0 + s->tolerance);
+  return 1;
+}
+
+/*!
+ * \brief Pins and vias.  Square and octagonal ones are taken as their
+ * bounding square.
+ */
+static int
+viaspot_pin_callback (const BoxType *targ, void *private)
+{
+  PinType *pin = (PinType *) targ;
+  struct viaspot *s = private;
+  double half = pin->Thickness / 2.0;
+
+  s->hits++;
+  if (s->blocked)
+    return 1;
+  if (TEST_FLAG (SQUAREFLAG | OCTAGONFLAG, pin))
+    viaspot_box (s, pin->X - half, pin->Y - half, pin->X + half,
+      pin->Y + half, viaspot_keep (s, pin->Clearance));
+  else
+    viaspot_box (s, pin->X, pin->Y, pin->X, pin->Y,
+      viaspot_keep (s, pin->Clearance) + half);
+  return 1;
+}
+
+/*!
+ * \brief Pads.  Square ones are taken as the rectangle around their
+ * ends.
+ */
+static int
+viaspot_pad_callback (const BoxType *targ, void *private)
+{
+  PadType *pad = (PadType *) targ;
+  struct viaspot *s = private;
+  double half = pad->Thickness / 2.0;
+
+  s->hits++;
+  if (s->blocked)
+    return 1;
+  if (TEST_FLAG (SQUAREFLAG, pad))
+    viaspot_box (s, MIN (pad->Point1.X, pad->Point2.X) - half,
+      MIN (pad->Point1.Y, pad->Point2.Y) - half,
+      MAX (pad->Point1.X, pad->Point2.X) + half,
+      MAX (pad->Point1.Y, pad->Point2.Y) + half,
+      viaspot_keep (s, pad->Clearance));
+  else
+    viaspot_segment (s, &pad->Point1, &pad->Point2,
+      viaspot_keep (s, pad->Clearance) + half);
+  return 1;
+}
+
+/*!
+ * \brief Whether a via fits at (x, y) without touching anything on any
+ * copper layer.
+ *
+ * Bounding boxes on the board include the clearance, so only objects
+ * whose boxes meet the via's, with its own clearance, can be in the way.
+ * The via itself has to stay on the board.
+ */
+static bool
+viaspot_fits (struct viaspot *s, Coord x, Coord y)
+{
+  BoxType box;
+  int l;
+
+  s->probes++;
+  s->x = x;
+  s->y = y;
+  s->blocked = false;
+  if (x - s->radius < 0 || y - s->radius < 0
+    || x + s->radius > PCB->MaxWidth || y + s->radius > PCB->MaxHeight)
+    return false;
+  box.X1 = x - s->radius - s->gap;
+  box.Y1 = y - s->radius - s->gap;
+  box.X2 = x + s->radius + s->gap + 1;
+  box.Y2 = y + s->radius + s->gap + 1;
+  if (PCB->Data->via_tree)
+    r_search (PCB->Data->via_tree, &box, NULL, viaspot_pin_callback, s);
+  if (!s->blocked && PCB->Data->pin_tree)
+    r_search (PCB->Data->pin_tree, &box, NULL, viaspot_pin_callback, s);
+  if (!s->blocked && PCB->Data->pad_tree)
+    r_search (PCB->Data->pad_tree, &box, NULL, viaspot_pad_callback, s);
+  for (l = 0; l < max_copper_layer && !s->blocked; l++)
+  {
+    LayerType *layer = &PCB->Data->Layer[l];
+
+    if (layer->line_tree)
+      r_search (layer->line_tree, &box, NULL, viaspot_line_callback, s);
+    if (!s->blocked && layer->arc_tree)
+      r_search (layer->arc_tree, &box, NULL, viaspot_arc_callback, s);
   }
-  pcb_fprintf (stderr, "\t%s\n", dirnames[side]);
-  if (info->line == NULL ||
-    (!nocentroid && (big - small) < info->centroid))
+  return !s->blocked;
+}
+
+/*!
+ * \brief A lattice point waiting to be tried, nearest first.
+ */
+struct viaspot_cell
+{
+  double d2;
+  int i, j;
+};
+
+static void
+viaspot_push (struct viaspot_cell **heap, int *n, int *max, double d2,
+  int i, int j)
+{
+  struct viaspot_cell *h, c;
+  int k = (*n)++, up;
+
+  *heap = (struct viaspot_cell *) grow_array (*heap, k, max,
+    sizeof (struct viaspot_cell));
+  h = *heap;
+  c.d2 = d2;
+  c.i = i;
+  c.j = j;
+  for (; k > 0 && h[up = (k - 1) / 2].d2 > d2; k = up)
+    h[k] = h[up];
+  h[k] = c;
+}
+
+static struct viaspot_cell
+viaspot_pop (struct viaspot_cell *h, int *n)
+{
+  struct viaspot_cell top = h[0], last = h[--(*n)];
+  int k = 0, c;
+
+  while ((c = 2 * k + 1) < *n)
+  {
+    if (c + 1 < *n && h[c + 1].d2 < h[c].d2)
+      c++;
+    if (h[c].d2 >= last.d2)
+      break;
+    h[k] = h[c];
+    k = c;
+  }
+  h[k] = last;
+  return top;
+}
+
+/*!
+ * \brief Find the nearest place to (x, y), within \p radius, where a
+ * via of the given diameter fits.
+ *
+ * Points on grid are tried best first, in order of distance, growing
+ * out from the nearest one: a point is only looked at once one of its
+ * neighbours, which is closer, has been tried.  Nothing on the board
+ * changes.
+ */
+static bool
+jostle_find_via_spot (Coord x, Coord y, Coord diameter, Coord radius,
+  Coord *spot_x, Coord *spot_y, int *probes)
+{
+  struct viaspot s;
+  struct viaspot_cell *heap = NULL, c;
+  int heap_n = 0, heap_max = 0, cells, side, k;
+  unsigned char *seen;
+  Coord grid, step, ox, oy, cx, cy;
+  bool found = false;
+  static const int di[4] = {1, -1, 0, 0}, dj[4] = {0, 0, 1, -1};
+
+  /* grid points, but not so fine that nothing is skipped quickly */
+  grid = MAX (PCB->Grid, 1);
+  step = grid;
+  if (step < diameter / 16)
+    step *= (diameter / 16 + step - 1) / step;
+  if (radius / step > 2000)
+  {
+    /* still a whole number of grid steps */
+    step = (radius + 1999) / 2000;
+    step = (step + grid - 1) / grid * grid;
+  }
+  cells = radius / step;
+  side = 2 * cells + 1;
+  seen = (unsigned char *) calloc ((size_t) side * side, 1);
+  ox = (x + step / 2) / step * step;
+  oy = (y + step / 2) / step * step;
+
+  memset (&s, 0, sizeof (s));
+  s.radius = diameter / 2.0;
+  /* new vias get twice the keepaway as their clearance */
+  s.gap = Settings.Keepaway;
+  s.tolerance = diameter / 32.0;
+  viaspot_push (&heap, &heap_n, &heap_max,
+    (double) (ox - x) * (ox - x) + (double) (oy - y) * (oy - y), 0, 0);
+  seen[cells * side + cells] = 1;
+  while (heap_n > 0)
   {
-    pcb_fprintf (stderr, "\tkeep it!\n");
-    if (info->smallest)
+    c = viaspot_pop (heap, &heap_n);
+    if (c.d2 > (double) radius * radius)
+      break; /* everything left is further */
+    cx = ox + c.i * step;
+    cy = oy + c.j * step;
+    if (viaspot_fits (&s, cx, cy))
     {
-      poly_Free (&info->smallest);
+      *spot_x = cx;
+      *spot_y = cy;
+      found = true;
+      break;
+    }
+    for (k = 0; k < 4; k++)
+    {
+      int i = c.i + di[k], j = c.j + dj[k];
+      double dx, dy;
+
+      if (abs (i) > cells || abs (j) > cells
+        || seen[(j + cells) * side + i + cells])
+        continue;
+      seen[(j + cells) * side + i + cells] = 1;
+      dx = (double) ox + (double) i * step - x;
+      dy = (double) oy + (double) j * step - y;
+      viaspot_push (&heap, &heap_n, &heap_max, dx * dx + dy * dy, i, j);
     }
-    info->centroid = nocentroid ? DBL_MAX : (big - small);
-    info->side = side;
-    info->line = line;
-    info->smallest = smallest;
-    return 1;
   }
-  return 0;
+  *probes = s.probes;
+  arccache_free (&s.arcs);
+  free (heap);
+  free (seen);
+  return found;
 }
 
 static int
-jostle (int argc, char **argv, Coord x, Coord y)
+find_via_spot (int argc, char **argv, Coord x, Coord y)
 {
+  Coord diameter, radius, sx, sy;
   bool rel;
-  POLYAREA *expand;
-  float value;
-  struct info info;
-  int found;
+  int probes;
+  char *where;
 
-  if (argc == 2)
+  if (argc < 1)
   {
-    value = GetValue (ARG(0), ARG(1), &rel);
+    Message (_("ERROR: in FindViaSpot, usage: %s\n"), find_via_spot_syntax);
+    return 1;
   }
-  else
+  diameter = GetValue (argv[0], NULL, &rel);
+  radius = argc > 1 ? GetValue (argv[1], NULL, &rel) : 10 * diameter;
+  if (diameter <= 0 || radius < 0)
   {
-    value = Settings.ViaThickness + (PCB->Bloat + 1) * 2 + 50;
+    Message (_("ERROR: in FindViaSpot, usage: %s\n"), find_via_spot_syntax);
+    return 1;
   }
-  x = Crosshair.X;
-  y = Crosshair.Y;
-  fprintf (stderr, "%d, %d, %f\n", (int)x, (int)y, value);
-  info.brush = CirclePoly (x, y, value / 2);
-  info.layer = CURRENT;
-  LINE_LOOP (info.layer);
+  if (!jostle_find_via_spot (Crosshair.X, Crosshair.Y, diameter, radius,
+    &sx, &sy, &probes))
   {
-    CLEAR_FLAG (DRCFLAG, line);
+    where = pcb_g_strdup_printf ("%$mS", radius);
+    Message (_("FindViaSpot: no room for a via within %s "
+      "(%d spots tried).\n"), where, probes);
+    g_free (where);
+    return 1;
   }
-  END_LOOP;
-  do
+  where = pcb_g_strdup_printf ("%$mD", sx, sy);
+  Message (_("FindViaSpot: via fits at %s (%d spots tried).\n"), where,
+    probes);
+  g_free (where);
+  gui->set_crosshair (sx, sy, HID_SC_PAN_VIEWPORT);
+  return 0;
+}
+
+/*!
+ * \brief JostleBudget([vertices])
+ *
+ * Sets or reports jostle_brush_budget.
+ */
+static int
+jostle_budget (int argc, char **argv, Coord x, Coord y)
+{
+  int budget;
+
+  if (argc == 0)
   {
-    info.box = POLYAREA_boundingBox (info.brush);
-    DebugPOLYAREA (info.brush, NULL);
-    pcb_fprintf (stderr, "search (%ms,%ms)->(%ms,%ms):\n", info.box.X1,info.box.Y1, info.box.X2,info.box.Y2);
-    info.line = NULL;
-    info.smallest = NULL;
-    found = r_search (info.layer->line_tree, &info.box, NULL, jostle_callback, &info);
-    if (found)
-    {
-      expand = NULL;
-      MakeBypassingLines (info.smallest, info.layer, info.line,
-        info.side, &expand);
-      poly_Free (&info.smallest);
-      poly_Boolean_free (info.brush, expand, &info.brush, PBO_UNITE);
-    }
-  } while (found);
-  SetChangedFlag (true);
-  IncrementUndoSerialNumber ();
+    Message (_("Jostle brush budget is %d vertices.\n"), jostle_brush_budget);
+    return 0;
+  }
+  budget = atoi (argv[0]);
+  if (budget < JOSTLE_MIN_BUDGET)
+  {
+    Message (_("ERROR: JostleBudget needs at least %d vertices.\n"),
+      JOSTLE_MIN_BUDGET);
+    return 1;
+  }
+  jostle_brush_budget = budget;
   return 0;
 }
 
 static HID_Action jostle_action_list[] =
 {
   {"jostle", NULL, jostle, "Move lines out of the way", jostle_syntax},
+  {"JostlePreview", NULL, jostle_preview,
+   "Show what jostling at the crosshair would do", jostle_preview_syntax},
+  {"JostleDrag", NULL, jostle_drag,
+   "Push lines out of the way along the crosshair's path", jostle_drag_syntax},
+#ifdef JOSTLE_RECORD
+  {"JostleReplay", NULL, jostle_replay,
+   "Show or save the recorded steps of the last jostles", jostle_replay_syntax},
+#endif
+  {"JostleStats", NULL, jostle_stats,
+   "Report what the last jostles did", jostle_stats_syntax},
+  {"JostleBench", NULL, jostle_bench,
+   "Time jostles on a synthetic bus", jostle_bench_syntax},
+  {"FindViaSpot", NULL, find_via_spot,
+   "Move the crosshair to the nearest place a via fits", find_via_spot_syntax},
+  {"JostleBudget", NULL, jostle_budget,
+   "Set the most vertices the jostle brush may have", jostle_budget_syntax},
 };
 
 REGISTER_ACTIONS (jostle_action_list)
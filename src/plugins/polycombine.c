@@ -10,18 +10,47 @@
  *
  * Compile like this:
  *
- * gcc -I$HOME/pcbsrc/git/src -I$HOME/pcbsrc/git -O2 -shared polycombine.c -o polycombine.so
+ * gcc -I$HOME/pcbsrc/git/src -I$HOME/pcbsrc/git -O2 -shared -pthread polycombine.c -o polycombine.so
  *
  * The resulting polycombine.so goes in $HOME/.pcb/plugins/polycombine.so.
  *
- * Usage: PolyCombine()
+ * Usage: PolyCombine([AllLayers])
  *
  * The selected polygons are combined together according to the ordering
- * of their points.
+ * of their points. Only the polygons on the layer of the first selected
+ * polygon are combined, unless AllLayers is given, when the selected
+ * polygons on every layer are combined at once, each layer on its own
+ * thread, and undone as one step.
+ *
+ * Usage: PolyImport(file, layer)
+ *
+ * Reads the polygons in a PCB layout file, such as pstoedit's pcbfill
+ * output, and combines them like PolyCombine() as they are read. Only
+ * the combined polygons are created, on the layer given by number
+ * (counting from 1) or name.
+ *
+ * Usage: PolyCombineBench(input, expected[, tiles[, tolerance]])
+ *
+ * Regression test and benchmark, which does not touch the board. Combines
+ * the polygons of the input file, repeated tiles by tiles times, and
+ * checks the result against the polygons of the expected file, tiled
+ * the same way: the area where they differ may be at most tolerance
+ * (0.001 by default) times the expected area. Reports PASS or FAIL and
+ * the time spent reading, building the tree and evaluating it. From the
+ * top of the source tree:
+ *
+ * echo "PolyCombineBench(examples/polycombine/uc.pcb, examples/polycombine/uc_combined.pcb, 4)" | pcb --gui batch
  */
 
 #include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "config.h"
 #include "global.h"
@@ -41,14 +70,82 @@
 #include "draw.h"
 #include "undo.h"
 
+/*!
+ * \brief Memory for the life of one action, handed out in pieces and
+ * released all at once.
+ *
+ * Only for things which never reach the polygon library, as it frees
+ * what it is given piece by piece. Not thread safe, so only allocate
+ * from the thread running the action.
+ */
+struct arena
+{
+  struct arena_chunk *chunks;
+  size_t used;          /* Of the newest chunk */
+  size_t size;          /* Of the newest chunk */
+};
+
+struct arena_chunk
+{
+  struct arena_chunk *next;
+  double data[1];       /* Aligned for anything we put here */
+};
+
+#define ARENA_CHUNK (64 * 1024)
+
+/*!
+ * \brief Allocate \p size bytes of zeroed memory from \p arena.
+ */
+static void *
+arena_alloc (struct arena *arena, size_t size)
+{
+  struct arena_chunk *chunk;
+  void *p;
+
+  size = (size + sizeof (double) - 1) / sizeof (double) * sizeof (double);
+  if (arena->chunks == NULL || arena->used + size > arena->size)
+    {
+      arena->size = MAX (size, ARENA_CHUNK);
+      chunk = malloc (offsetof (struct arena_chunk, data) + arena->size);
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+      arena->used = 0;
+    }
+  p = (char *) arena->chunks->data + arena->used;
+  arena->used += size;
+  memset (p, 0, size);
+  return p;
+}
+
+static void
+arena_free (struct arena *arena)
+{
+  struct arena_chunk *chunk, *next;
+
+  for (chunk = arena->chunks; chunk != NULL; chunk = next)
+    {
+      next = chunk->next;
+      free (chunk);
+    }
+  memset (arena, 0, sizeof (*arena));
+}
+
+/*!
+ * \brief Make a POLYAREA from a point list laid out like a polygon's,
+ * with the holes starting at the indices in \p hole_index.
+ *
+ * \p forward is set to whether the outer contour was given
+ * counterclockwise. The contours are turned round as needed.
+ */
 static POLYAREA *
-original_poly (PolygonType * p, bool *forward)
+points_poly (const PointType *points, Cardinal point_n,
+             const Cardinal *hole_index, Cardinal hole_n, bool *forward)
 {
   PLINE *contour = NULL;
   POLYAREA *np = NULL;
   Cardinal n;
   Vector v;
-  int hole = 0;
+  Cardinal hole = 0;
 
   *forward = true;
 
@@ -56,17 +153,20 @@ original_poly (PolygonType * p, bool *forward)
     return NULL;
 
   /* first make initial polygon contour */
-  for (n = 0; n < p->PointN; n++)
+  for (n = 0; n < point_n; n++)
     {
       /* No current contour? Make a new one starting at point */
       /*   (or) Add point to existing contour */
 
-      v[0] = p->Points[n].X;
-      v[1] = p->Points[n].Y;
+      v[0] = points[n].X;
+      v[1] = points[n].Y;
       if (contour == NULL)
         {
           if ((contour = poly_NewContour (v)) == NULL)
-            return NULL;
+            {
+              poly_Free (&np);
+              return NULL;
+            }
         }
       else
         {
@@ -74,8 +174,8 @@ original_poly (PolygonType * p, bool *forward)
         }
 
       /* Is current point last in contour? If so process it. */
-      if (n == p->PointN - 1 ||
-          (hole < p->HoleIndexN && n == p->HoleIndex[hole] - 1))
+      if (n == point_n - 1 ||
+          (hole < hole_n && n == hole_index[hole] - 1))
         {
           poly_PreContour (contour, TRUE);
 
@@ -98,10 +198,19 @@ original_poly (PolygonType * p, bool *forward)
   return np;
 }
 
+static POLYAREA *
+original_poly (PolygonType * p, bool *forward)
+{
+  return points_poly (p->Points, p->PointN, p->HoleIndex, p->HoleIndexN,
+                      forward);
+}
+
 typedef struct poly_tree poly_tree;
 
 struct poly_tree
 {
+  BoxType box;        /* Of the outer contour, first so nodes can go in an r-tree */
+  double area;        /* Of the outer contour */
   PolygonType *polygon;
   bool forward;
   POLYAREA *polyarea;
@@ -129,9 +238,9 @@ struct poly_tree
  * |_____________________|
  *
  * </pre>
- * As we encounter each polygon, it gets a record. We need to check
- * whether it contains any of the polygons existing in our tree. If
- * it does, it will become the parent of them. (Check breadth first).
+ * Polygons are placed in the tree largest first, so any polygon which
+ * contains another is already there when the smaller one arrives. Its
+ * parent is then the smallest polygon already placed which contains it.
  *
  * When processing, work top down (breadth first), although if the
  * contours can be assumed not to overlap, we can drill down in this
@@ -140,177 +249,884 @@ struct poly_tree
 static bool
 PolygonContainsPolygon (POLYAREA *outer, POLYAREA *inner)
 {
-//  int contours_isect;
-  /* Should check outer contours don't intersect? */
-//  contours_isect = Touching (outer, inner);
-  /* Cheat and assume simple single contour polygons for now */
-//  return contours_isect ?
-//           0 : poly_ContourInContour (outer->contours, inner->contours);
-  return poly_ContourInContour (outer->contours, inner->contours);
+  POLYAREA *i = inner;
+  POLYAREA *o;
+
+  /* Contours which cross or touch were merged by merge_overlaps(), so
+   * testing the contours is enough. Each island of inner has to be in
+   * one of outer's.
+   */
+  do
+    {
+      for (o = outer; !poly_ContourInContour (o->contours, i->contours); )
+        if ((o = o->f) == outer)
+          return false;
+    }
+  while ((i = i->f) != inner);
+
+  return true;
 }
 
+static int
+poly_tree_larger_first (const void *va, const void *vb)
+{
+  const poly_tree *a = *(poly_tree * const *) va;
+  const poly_tree *b = *(poly_tree * const *) vb;
 
+  if (a->area != b->area)
+    return a->area < b->area ? 1 : -1;
+  return 0;
+}
+
+struct parent_search
+{
+  poly_tree *node;
+  poly_tree *parent;    /* Smallest container found so far */
+};
+
+/*!
+ * \brief r_search callback looking for the smallest polygon containing
+ * the one being placed.
+ *
+ * The contour test only runs on polygons whose bounding box contains
+ * the new one's, and which are smaller than the best parent yet.
+ */
+static int
+parent_search_callback (const BoxType *b, void *cl)
+{
+  poly_tree *candidate = (poly_tree *) b;
+  struct parent_search *search = cl;
+  BoxType *box = &search->node->box;
+
+  if (b->X1 > box->X1 || b->Y1 > box->Y1 || b->X2 < box->X2 || b->Y2 < box->Y2)
+    return 0;
+
+  if (search->parent != NULL && candidate->area >= search->parent->area)
+    return 0;
+
+  if (!PolygonContainsPolygon (candidate->polyarea, search->node->polyarea))
+    return 0;
+
+  search->parent = candidate;
+  return 1;
+}
+
+/*!
+ * \brief Arrange \p nodes into a nesting tree, returning the first of
+ * the top level nodes.
+ *
+ * The nodes are sorted in place, largest first.
+ */
 static poly_tree *
-insert_node_recursive (poly_tree *start_point, poly_tree *to_insert)
+build_poly_tree (poly_tree **nodes, int n)
+{
+  struct parent_search search;
+  poly_tree *root = NULL;
+  poly_tree *node;
+  rtree_t *placed;
+  poly_tree **siblings;
+  int i;
+
+  qsort (nodes, n, sizeof (poly_tree *), poly_tree_larger_first);
+
+  placed = r_create_tree (NULL, 0, 0);
+
+  for (i = 0; i < n; i++)
+    {
+      node = nodes[i];
+
+      search.node = node;
+      search.parent = NULL;
+      r_search (placed, &node->box, NULL, parent_search_callback, &search);
+
+      /* Prepend to the parent's children, or to the top level */
+      node->parent = search.parent;
+      siblings = (search.parent != NULL) ? &search.parent->child : &root;
+      node->prev = NULL;
+      node->next = *siblings;
+      if (*siblings)
+        (*siblings)->prev = node;
+      *siblings = node;
+
+      r_insert_entry (placed, &node->box, 0);
+    }
+
+  r_destroy_tree (&placed);
+
+  return root;
+}
+
+/*!
+ * \brief Unite the polygons in \p polys, which are consumed, as a
+ * balanced binary reduction so no boolean works on a result much larger
+ * than its other operand. Empty (NULL) entries are skipped.
+ */
+static POLYAREA *
+unite_balanced (POLYAREA **polys, int n)
+{
+  POLYAREA *a, *b, *res;
+
+  if (n == 0)
+    return NULL;
+  if (n == 1)
+    return polys[0];
+
+  a = unite_balanced (polys, n / 2);
+  b = unite_balanced (polys + n / 2, n - n / 2);
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+
+  poly_Boolean_free (a, b, &res, PBO_UNITE);
+  return res;
+}
+
+struct combine_layer;
+
+/*!
+ * \brief Work handed out to the worker threads, one index at a time.
+ */
+struct combine_pool
 {
-  poly_tree *cur_node, *next = NULL;
-//  bool to_insert_isects_cur_node;   /* Intersection */
-  bool to_insert_contains_cur_node; /* Containment */
-  bool cur_node_contains_to_insert; /* Containment */
-  bool placed_to_insert = false;
+  void (*job) (struct combine_pool *pool, int i);
+  int n;
+  int next;
+  pthread_mutex_t lock;
+  poly_tree **nodes;
+  struct combine_layer *layers;
+  POLYAREA **filled;    /* Per node results, or polygons to unite in pairs */
+  POLYAREA **regions;   /* Per node areas, or the pairs' unions */
+};
 
-  poly_tree *return_root = start_point;
+static void *
+combine_worker (void *data)
+{
+  struct combine_pool *pool = data;
+  int i;
 
-  if (start_point == NULL)
+  for (;;)
     {
-//      printf ("start_point is NULL, so returning to_insert\n");
-      //to_insert->parent = !!; UNDEFINED
-      return to_insert;
+      pthread_mutex_lock (&pool->lock);
+      i = pool->next++;
+      pthread_mutex_unlock (&pool->lock);
+      if (i >= pool->n)
+        return NULL;
+      pool->job (pool, i);
     }
+}
+
+/*!
+ * \brief Run \p pool's job for every index on as many threads as there
+ * are processors.
+ */
+static void
+combine_run (struct combine_pool *pool)
+{
+  pthread_t *threads;
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  int i, n;
 
-  /* Investigate the start point and its peers first */
-  for (cur_node = start_point; cur_node != NULL; cur_node = next)
+  n = MIN (cpus > 0 ? cpus : 1, pool->n);
+  pool->next = 0;
+  /* combine_worker() locks even when it runs alone */
+  pthread_mutex_init (&pool->lock, NULL);
+  if (n <= 1)
     {
-      next = cur_node->next;
+      combine_worker (pool);
+      pthread_mutex_destroy (&pool->lock);
+      return;
+    }
+
+  threads = malloc (n * sizeof (pthread_t));
+  for (i = 0; i < n; i++)
+    if (pthread_create (&threads[i], NULL, combine_worker, pool) != 0)
+      break;
+  /* If no thread could be started, do the work here */
+  if (i == 0)
+    combine_worker (pool);
+  while (i-- > 0)
+    pthread_join (threads[i], NULL);
+  free (threads);
+  pthread_mutex_destroy (&pool->lock);
+}
+
+static void
+unite_pair_job (struct combine_pool *pool, int i)
+{
+  pool->regions[i] = unite_balanced (pool->filled + 2 * i, 2);
+}
+
+/*!
+ * \brief Like unite_balanced(), with each level of the reduction spread
+ * over the worker threads.
+ */
+static POLYAREA *
+unite_parallel (POLYAREA **polys, int n)
+{
+  struct combine_pool pool;
+
+  memset (&pool, 0, sizeof (pool));
+  pool.job = unite_pair_job;
+  pool.filled = polys;
+  pool.regions = malloc ((n / 2 + 1) * sizeof (POLYAREA *));
+  while (n > 2)
+    {
+      pool.n = n / 2;
+      combine_run (&pool);
+      memcpy (polys, pool.regions, pool.n * sizeof (POLYAREA *));
+      /* An odd one out moves up to the next level as it is */
+      if (n & 1)
+        polys[n / 2] = polys[n - 1];
+      n = (n + 1) / 2;
+    }
+  free (pool.regions);
+  return unite_balanced (polys, n);
+}
+
+static POLYAREA *compute_polygon_tree (poly_tree *node, POLYAREA **region,
+                                       bool parallel);
+
+static void
+compute_node_job (struct combine_pool *pool, int i)
+{
+  pool->filled[i] = compute_polygon_tree (pool->nodes[i],
+                                          pool->regions ? &pool->regions[i] : NULL,
+                                          false);
+}
+
+/*!
+ * \brief Compute \p first and its peers independently of each other.
+ *
+ * Returns an array with the filled part of each, and if \p regions is
+ * given, an array of the area each covers. When \p parallel is set, the
+ * peers are spread over the worker threads, or if there is only one,
+ * its own children are.
+ */
+static int
+compute_siblings (poly_tree *first, POLYAREA ***filled, POLYAREA ***regions,
+                  bool parallel)
+{
+  struct combine_pool pool;
+  poly_tree *cur_node;
+  int i, n = 0;
+
+  for (cur_node = first; cur_node != NULL; cur_node = cur_node->next)
+    n++;
+
+  memset (&pool, 0, sizeof (pool));
+  pool.job = compute_node_job;
+  pool.n = n;
+  pool.nodes = malloc (n * sizeof (poly_tree *));
+  pool.filled = calloc (n, sizeof (POLYAREA *));
+  if (regions)
+    pool.regions = calloc (n, sizeof (POLYAREA *));
+  for (i = 0, cur_node = first; cur_node != NULL; cur_node = cur_node->next)
+    pool.nodes[i++] = cur_node;
+
+  if (parallel && n > 1)
+    combine_run (&pool);
+  else
+    for (i = 0; i < n; i++)
+      pool.filled[i] = compute_polygon_tree (pool.nodes[i],
+                                             regions ? &pool.regions[i] : NULL,
+                                             parallel);
+
+  free (pool.nodes);
+  *filled = pool.filled;
+  if (regions)
+    *regions = pool.regions;
+  return n;
+}
+
+/*!
+ * \brief Compute what is filled within \p node once it and everything
+ * nested in it have been applied, consuming the node's polygon.
+ *
+ * A forward node fills its area, then each child replaces what is
+ * inside the child's area with its own result:
+ *
+ *   filled = (area - children's areas) + children's filled parts
+ *
+ * A backward node clears its area, leaving only its children's filled
+ * parts. The children's unions are balanced reductions. If \p region is
+ * given, the node's area is returned there.
+ */
+static POLYAREA *
+compute_polygon_tree (poly_tree *node, POLYAREA **region, bool parallel)
+{
+  POLYAREA *area = node->polyarea;
+  POLYAREA *res, *covered;
+  POLYAREA **filled, **regions = NULL;
+  int n;
+
+  node->polyarea = NULL;
 
-//      to_insert_isects_cur_node = IsPolygonInPolygon (to_insert->polygon, cur_node->polygon);
-      to_insert_contains_cur_node = PolygonContainsPolygon (to_insert->polyarea, cur_node->polyarea);
+  n = compute_siblings (node->child, &filled, node->forward ? &regions : NULL,
+                        parallel);
 
-#if 0
-      printf ("Inspecting polygon %ld %s, curnode is %ld %s: to_insert_isects_cur_node = %d, to_insert_contains_cur_node = %i\n",
-              to_insert->polygon->ID,
-              to_insert->forward ? "FWD" : "BWD",
-              cur_node->polygon->ID,
-              cur_node->forward ? "FWD" : "BWD",
-              to_insert_isects_cur_node,
-              to_insert_contains_cur_node);
+  if (node->forward)
+    {
+      if (region)
+        poly_M_Copy0 (region, area);
 
-      if (to_insert_isects_cur_node) /* Place as peer of this node? */
+      covered = parallel ? unite_parallel (regions, n) : unite_balanced (regions, n);
+      if (covered != NULL)
         {
+          poly_Boolean_free (area, covered, &res, PBO_SUB);
+          area = res;
         }
-#endif
+      free (regions);
+      regions = NULL;
+    }
+  else
+    {
+      if (region)
+        *region = area;
+      else
+        poly_Free (&area);
+      area = NULL;
+    }
 
-      if (to_insert_contains_cur_node) /* Should be a parent of this node */
-        {
-          /* Remove cur_node from its peers */
-          if (cur_node->prev)
-            cur_node->prev->next = cur_node->next;
-          if (cur_node->next)
-            cur_node->next->prev = cur_node->prev;
-
-          /* If we've not yet got a home, insert the to_insert node where cur_node was previously */
-          if (!placed_to_insert)
-            {
-              to_insert->parent = cur_node->parent;
-              to_insert->next = cur_node->next;
-              to_insert->prev = cur_node->prev;
-              if (to_insert->prev)
-                to_insert->prev->next = to_insert;
-              if (to_insert->next)
-                to_insert->next->prev = to_insert;
-              placed_to_insert = true;
-
-              if (cur_node == start_point)
-                return_root = to_insert;
-            }
+  /* area is what is left filled; add the children's filled parts */
+  filled = realloc (filled, (n + 1) * sizeof (POLYAREA *));
+  filled[n] = area;
+  res = parallel ? unite_parallel (filled, n + 1) : unite_balanced (filled, n + 1);
+  free (filled);
 
-          /* Prepend cur_node to our list of children */
-          cur_node->parent = to_insert;
+  return res;
+}
 
-          cur_node->prev = NULL;
-          cur_node->next = to_insert->child;
-          if (to_insert->child)
-            to_insert->child->prev = cur_node;
-          to_insert->child = cur_node;
+/*!
+ * \brief Compute the combined polygon of the whole tree.
+ *
+ * Nothing is filled to start with, so it is just the union of the top
+ * level nodes' filled parts.
+ */
+static POLYAREA *
+compute_polygon (poly_tree *root, bool parallel)
+{
+  POLYAREA **filled;
+  POLYAREA *res;
+  int n;
 
-        }
+  n = compute_siblings (root, &filled, NULL, parallel);
+  res = parallel ? unite_parallel (filled, n) : unite_balanced (filled, n);
+  free (filled);
+
+  return res;
+}
+
+/*!
+ * \brief Seconds on a monotonic clock, for timing.
+ */
+static double
+combine_now (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*!
+ * \brief Set a node's bounding box and area from all the islands of its
+ * polygon.
+ */
+static void
+poly_tree_measure (poly_tree *node)
+{
+  POLYAREA *pa = node->polyarea;
+  PLINE *outer;
+
+  node->box.X1 = node->box.Y1 = MAX_COORD;
+  node->box.X2 = node->box.Y2 = -MAX_COORD;
+  node->area = 0;
+  do
+    {
+      outer = pa->contours;
+      MAKEMIN (node->box.X1, outer->xmin);
+      MAKEMIN (node->box.Y1, outer->ymin);
+      MAKEMAX (node->box.X2, outer->xmax + 1);
+      MAKEMAX (node->box.Y2, outer->ymax + 1);
+      node->area += fabs (outer->area);
     }
+  while ((pa = pa->f) != node->polyarea);
+}
 
-  if (placed_to_insert)
+/*!
+ * \brief One contour edge, for the overlap sweep.
+ */
+struct sweep_edge
+{
+  Coord x1, y1;         /* The end with the smaller X */
+  Coord x2, y2;
+  Coord ymin, ymax;
+  int node;             /* Index of the node it belongs to */
+};
+
+static int
+sweep_edge_compare (const void *va, const void *vb)
+{
+  const struct sweep_edge *a = va;
+  const struct sweep_edge *b = vb;
+
+  return (a->x1 > b->x1) - (a->x1 < b->x1);
+}
+
+static int
+sweep_side (Coord ax, Coord ay, Coord bx, Coord by, Coord px, Coord py)
+{
+  long long cross = (long long) (bx - ax) * (py - ay)
+                    - (long long) (by - ay) * (px - ax);
+
+  return (cross > 0) - (cross < 0);
+}
+
+/*!
+ * \brief Whether two edges cross or touch, exactly.
+ */
+static bool
+sweep_edges_meet (const struct sweep_edge *a, const struct sweep_edge *b)
+{
+  int d1 = sweep_side (a->x1, a->y1, a->x2, a->y2, b->x1, b->y1);
+  int d2 = sweep_side (a->x1, a->y1, a->x2, a->y2, b->x2, b->y2);
+  int d3 = sweep_side (b->x1, b->y1, b->x2, b->y2, a->x1, a->y1);
+  int d4 = sweep_side (b->x1, b->y1, b->x2, b->y2, a->x2, a->y2);
+
+  if (d1 * d2 > 0 || d3 * d4 > 0)
+    return false;
+  if (d1 != 0 || d2 != 0)
+    return true;
+  /* Collinear, so they meet if their ranges do */
+  return a->x1 <= b->x2 && b->x1 <= a->x2
+         && a->ymin <= b->ymax && b->ymin <= a->ymax;
+}
+
+/*!
+ * \brief An edge by one of its coordinates, for sorting.
+ */
+struct sweep_key
+{
+  Coord key;
+  int edge;
+};
+
+static int
+sweep_key_compare (const void *va, const void *vb)
+{
+  const struct sweep_key *a = va;
+  const struct sweep_key *b = vb;
+
+  return (a->key > b->key) - (a->key < b->key);
+}
+
+#define SWEEP_EMPTY (-MAX_COORD - 1)
+
+/*!
+ * \brief The edges the sweep has reached and not yet passed.
+ *
+ * A binary tree over every edge, in order of ymin, in which each
+ * subtree holds the largest ymax of its active edges, or SWEEP_EMPTY.
+ */
+struct sweep_tree
+{
+  int size;             /* Leaves, a power of two */
+  Coord *ymax;          /* Per tree node, the root being 1 */
+  int *edge;            /* Per leaf, the edge it stands for */
+};
+
+static void
+sweep_tree_set (struct sweep_tree *t, int leaf, Coord ymax)
+{
+  int node = t->size + leaf;
+
+  t->ymax[node] = ymax;
+  for (node /= 2; node >= 1; node /= 2)
+    t->ymax[node] = MAX (t->ymax[2 * node], t->ymax[2 * node + 1]);
+}
+
+/*!
+ * \brief Add to \p found the active edges among leaves \p lo to \p hi
+ * (exclusive) of \p node, and before leaf \p end, reaching up to
+ * \p ymin.
+ *
+ * Returns the new number of edges in \p found.
+ */
+static int
+sweep_tree_find (const struct sweep_tree *t, int node, int lo, int hi,
+                 int end, Coord ymin, int *found, int found_n)
+{
+  int mid;
+
+  if (lo >= end || t->ymax[node] < ymin)
+    return found_n;
+  if (hi - lo == 1)
     {
-//      printf ("Returning new root %ld\n", return_root->polygon->ID);
-      return return_root;
+      found[found_n++] = t->edge[lo];
+      return found_n;
     }
-//    return (to_insert->parent == NULL) ? to_insert : to_insert->parent;
+  mid = (lo + hi) / 2;
+  found_n = sweep_tree_find (t, 2 * node, lo, mid, end, ymin, found, found_n);
+  return sweep_tree_find (t, 2 * node + 1, mid, hi, end, ymin, found, found_n);
+}
 
-  /* Ok, so we still didn't find anywhere which the to_insert contour contained,
-   * we need to start looking at the children of the start_point and its peers.
-   */
-//  printf ("Looking at child nodes of the start_point\n");
+static int
+cluster_find (int *parent, int i)
+{
+  while (parent[i] != i)
+    i = parent[i] = parent[parent[i]];
+  return i;
+}
+
+/*!
+ * \brief Group the nodes whose contours cross or touch each other.
+ *
+ * A sweep from left to right over every edge, keeping the edges whose X
+ * range spans the sweep position. A new edge is only tested exactly
+ * against active edges whose Y range meets its own, and which belong to
+ * nodes not yet known to be in its group; which edges cross within one
+ * group does not matter. The active edges are kept in a sweep_tree, so
+ * adding, dropping and finding each one takes O(log E) for E edges.
+ *
+ * On return, parent[] holds the first node of each node's group.
+ * Returns how many nodes are in another node's group.
+ */
+static int
+find_overlaps (poly_tree **nodes, int n, int *parent)
+{
+  struct sweep_edge *edges, *e, *a;
+  struct sweep_key *by_ymin, *by_x2;
+  struct sweep_tree tree;
+  int *leaf, *found;
+  int edge_n = 0, found_n, passed, lo, hi, i, j, grouped = 0;
+  POLYAREA *pa;
+  PLINE *pl;
+  VNODE *v;
 
-  /* Investigate the start point and its peers first */
-  for (cur_node = start_point; cur_node != NULL; cur_node = next)
+  for (i = 0; i < n; i++)
     {
-      next = cur_node->next;
+      parent[i] = i;
+      pa = nodes[i]->polyarea;
+      do
+        for (pl = pa->contours; pl != NULL; pl = pl->next)
+          edge_n += pl->Count;
+      while ((pa = pa->f) != nodes[i]->polyarea);
+    }
 
-      cur_node_contains_to_insert = PolygonContainsPolygon (cur_node->polyarea, to_insert->polyarea);
+  edges = malloc (edge_n * sizeof (struct sweep_edge));
 
-#if 0
-      printf ("Inspecting polygon %ld, curnode is %ld: cur_node_contains_to_insert = %d\n",
-              to_insert->polygon->ID, cur_node->polygon->ID,
-              cur_node_contains_to_insert);
-#endif
+  for (edge_n = i = 0; i < n; i++)
+    {
+      pa = nodes[i]->polyarea;
+      do
+        for (pl = pa->contours; pl != NULL; pl = pl->next)
+          {
+            v = &pl->head;
+            do
+              {
+                e = &edges[edge_n++];
+                e->node = i;
+                if (v->point[0] <= v->next->point[0])
+                  {
+                    e->x1 = v->point[0]; e->y1 = v->point[1];
+                    e->x2 = v->next->point[0]; e->y2 = v->next->point[1];
+                  }
+                else
+                  {
+                    e->x1 = v->next->point[0]; e->y1 = v->next->point[1];
+                    e->x2 = v->point[0]; e->y2 = v->point[1];
+                  }
+                e->ymin = MIN (e->y1, e->y2);
+                e->ymax = MAX (e->y1, e->y2);
+              }
+            while ((v = v->next) != &pl->head);
+          }
+      while ((pa = pa->f) != nodes[i]->polyarea);
+    }
+
+  qsort (edges, edge_n, sizeof (struct sweep_edge), sweep_edge_compare);
+
+  /* The tree's leaves, in order of ymin, and the order edges are passed */
+  by_ymin = malloc (edge_n * sizeof (struct sweep_key));
+  by_x2 = malloc (edge_n * sizeof (struct sweep_key));
+  for (i = 0; i < edge_n; i++)
+    {
+      by_ymin[i].key = edges[i].ymin;
+      by_ymin[i].edge = i;
+      by_x2[i].key = edges[i].x2;
+      by_x2[i].edge = i;
+    }
+  qsort (by_ymin, edge_n, sizeof (struct sweep_key), sweep_key_compare);
+  qsort (by_x2, edge_n, sizeof (struct sweep_key), sweep_key_compare);
+
+  for (tree.size = 1; tree.size < edge_n; tree.size *= 2)
+    ;
+  tree.ymax = malloc (2 * tree.size * sizeof (Coord));
+  tree.edge = malloc (tree.size * sizeof (int));
+  for (i = 0; i < 2 * tree.size; i++)
+    tree.ymax[i] = SWEEP_EMPTY;
+  leaf = malloc (edge_n * sizeof (int));
+  for (i = 0; i < edge_n; i++)
+    {
+      tree.edge[i] = by_ymin[i].edge;
+      leaf[by_ymin[i].edge] = i;
+    }
+  found = malloc (edge_n * sizeof (int));
 
-      /* Need to look at the child, ONLY if we know it engulfs our to_insert polygon */
-      if (cur_node_contains_to_insert)
+  for (passed = i = 0; i < edge_n; i++)
+    {
+      e = &edges[i];
+
+      /* Drop the edges the sweep has passed; all were added before */
+      for (; passed < edge_n && by_x2[passed].key < e->x1; passed++)
+        sweep_tree_set (&tree, leaf[by_x2[passed].edge], SWEEP_EMPTY);
+
+      /* Only leaves with ymin up to e->ymax can meet it */
+      for (lo = 0, hi = edge_n; lo < hi;)
+        if (by_ymin[(lo + hi) / 2].key <= e->ymax)
+          lo = (lo + hi) / 2 + 1;
+        else
+          hi = (lo + hi) / 2;
+
+      found_n = sweep_tree_find (&tree, 1, 0, tree.size, lo, e->ymin,
+                                 found, 0);
+      for (j = 0; j < found_n; j++)
         {
-          /* Can't set the parent within the call, so: */
-          to_insert->parent = cur_node;
-          cur_node->child = insert_node_recursive (cur_node->child, to_insert);
-          return start_point;
-          //return cur_node->parent;
+          a = &edges[found[j]];
+          if (cluster_find (parent, a->node) == cluster_find (parent, e->node))
+            continue;
+          if (sweep_edges_meet (a, e))
+            parent[cluster_find (parent, a->node)] = cluster_find (parent, e->node);
         }
+
+      sweep_tree_set (&tree, leaf[i], e->ymax);
+    }
+
+  free (found);
+  free (leaf);
+  free (tree.edge);
+  free (tree.ymax);
+  free (by_x2);
+  free (by_ymin);
+  free (edges);
+
+  /* Leave each node pointing straight at its group's root */
+  for (i = 0; i < n; i++)
+    {
+      parent[i] = cluster_find (parent, i);
+      if (parent[i] != i)
+        grouped++;
     }
 
-//  if (!placed_to_insert)
-    /* prepend to_insert polygon to peer of start_point ? */
-//  printf ("Prepending as peer to start_poly\n");
-  to_insert->parent = start_point->parent;
-  to_insert->prev = NULL;
-  to_insert->next = start_point;
-  to_insert->next->prev = to_insert;
+  return grouped;
+}
+
+static int
+group_then_larger_first (const void *va, const void *vb)
+{
+  const poly_tree *a = *(poly_tree * const *) va;
+  const poly_tree *b = *(poly_tree * const *) vb;
 
-  return to_insert;
+  if (a->parent != b->parent)
+    return (a->parent > b->parent) - (a->parent < b->parent);
+  return poly_tree_larger_first (va, vb);
 }
 
-static POLYAREA *
-compute_polygon_recursive (poly_tree *root, POLYAREA *accumulate)
+/*!
+ * \brief Replace each group of overlapping nodes by one node, holding
+ * the group's polygons combined with full booleans.
+ *
+ * Members are taken largest first. Those turning the same way as the
+ * largest are united with it, the others are subtracted, so a group of
+ * holes becomes one hole. The combined node is the largest member's;
+ * the others are left out of \p tree.
+ *
+ * Returns the number of nodes for the tree, and the number of groups
+ * merged in \p merged.
+ */
+static int
+merge_overlaps (poly_tree **nodes, int n, poly_tree **tree, int *merged)
 {
+  poly_tree **order, *lead, *node;
   POLYAREA *res;
-  poly_tree *cur_node;
-  for (cur_node = root; cur_node != NULL; cur_node = cur_node->next)
+  int *parent;
+  int i, j, tree_n = 0;
+
+  *merged = 0;
+  parent = malloc (n * sizeof (int));
+  if (find_overlaps (nodes, n, parent) == 0)
     {
-      /* Process this element */
-//      printf ("Processing node %ld %s\n", cur_node->polygon->ID, cur_node->forward ? "FWD" : "BWD");
-      poly_Boolean_free (accumulate, cur_node->polyarea, &res, cur_node->forward ? PBO_UNITE : PBO_SUB);
-      accumulate = res;
+      free (parent);
+      memcpy (tree, nodes, n * sizeof (poly_tree *));
+      return n;
+    }
+
+  /* Gather each group's members, largest first */
+  order = malloc (n * sizeof (poly_tree *));
+  for (i = 0; i < n; i++)
+    order[i] = nodes[i];
+  for (i = 0; i < n; i++)
+    nodes[i]->parent = nodes[parent[i]];  /* Borrowed until the tree is built */
+  qsort (order, n, sizeof (poly_tree *), group_then_larger_first);
 
-      /* And its children if it has them */
-      if (cur_node->child)
+  for (i = 0; i < n; i = j)
+    {
+      lead = order[i];
+      for (j = i + 1; j < n && order[j]->parent == lead->parent; j++)
+        {
+          node = order[j];
+          if (lead->polyarea == NULL)
+            {
+              /* Nothing left to subtract from */
+              if (node->forward == lead->forward)
+                lead->polyarea = node->polyarea;
+              else
+                poly_Free (&node->polyarea);
+            }
+          else
+            {
+              poly_Boolean_free (lead->polyarea, node->polyarea, &res,
+                                 node->forward == lead->forward ?
+                                 PBO_UNITE : PBO_SUB);
+              lead->polyarea = res;
+            }
+          node->polyarea = NULL;
+        }
+      if (j > i + 1)
         {
-//          printf ("Processing children\n");
-          accumulate = compute_polygon_recursive (cur_node->child, accumulate);
+          (*merged)++;
+          if (lead->polyarea == NULL)
+            continue;
+          poly_tree_measure (lead);
         }
+      tree[tree_n++] = lead;
     }
-  return accumulate;
+
+  for (i = 0; i < n; i++)
+    nodes[i]->parent = NULL;
+  free (order);
+  free (parent);
+  return tree_n;
 }
 
+/*!
+ * \brief The selected polygons of one layer, and what they combine to.
+ */
+struct combine_layer
+{
+  LayerType *layer;
+  poly_tree **nodes;
+  int nodes_n;
+  int nodes_max;
+  POLYAREA *result;
+  int merged;           /* Groups of overlapping polygons merged */
+  double tree_time;     /* Seconds spent merging overlaps and nesting */
+  double boolean_time;  /* Seconds spent evaluating the tree */
+};
+
+/*!
+ * \brief Add a node for \p np, which may come from \p polygon, or from
+ * nowhere on the board.
+ */
+static void
+combine_layer_insert (struct combine_layer *cl, PolygonType *polygon,
+                      POLYAREA *np, bool forward, struct arena *arena)
+{
+  poly_tree *this_node;
+
+  /* Leave polygons with no points alone */
+  if (np != NULL && np->contours == NULL)
+    poly_Free (&np);
+  if (np == NULL)
+    return;
+
+  /* Build a poly_tree record */
+  this_node = arena_alloc (arena, sizeof (poly_tree));
+  this_node->polygon = polygon;
+  this_node->forward = forward;
+  this_node->polyarea = np;
+  poly_tree_measure (this_node);
+
+  if (cl->nodes_n == cl->nodes_max)
+    {
+      cl->nodes_max = cl->nodes_max ? cl->nodes_max * 2 : 64;
+      cl->nodes = realloc (cl->nodes, cl->nodes_max * sizeof (poly_tree *));
+    }
+  cl->nodes[cl->nodes_n++] = this_node;
+}
+
+static void
+combine_layer_add (struct combine_layer *cl, PolygonType *polygon,
+                   struct arena *arena)
+{
+  POLYAREA *np;
+  bool forward;
+
+  np = original_poly (polygon, &forward);
+  combine_layer_insert (cl, polygon, np, forward, arena);
+}
+
+/*!
+ * \brief Build a layer's tree and compute its polygon.
+ *
+ * Only the polygon library is used, the board is not touched, so
+ * layers can be done on separate threads.
+ */
+static void
+combine_layer_compute (struct combine_layer *cl, bool parallel)
+{
+  poly_tree **tree;
+  poly_tree *root;
+  int tree_n;
+  double start = combine_now ();
+
+  /* Overlapping polygons can't be nested, so combine them first */
+  tree = malloc (cl->nodes_n * sizeof (poly_tree *));
+  tree_n = merge_overlaps (cl->nodes, cl->nodes_n, tree, &cl->merged);
+
+  /* Work out where each node goes in the tree */
+  root = build_poly_tree (tree, tree_n);
+  free (tree);
+  cl->tree_time = combine_now () - start;
+
+  /* Now perform a traversal of the tree, computing a polygon */
+  start = combine_now ();
+  cl->result = compute_polygon (root, parallel);
+  cl->boolean_time = combine_now () - start;
+}
+
+static void
+combine_layer_job (struct combine_pool *pool, int i)
+{
+  combine_layer_compute (&pool->layers[i], false);
+}
+
+static const char polycombine_syntax[] = "PolyCombine([AllLayers])";
+
 static int
 polycombine (int argc, char **argv, Coord x, Coord y)
 {
-  POLYAREA *res;
-  bool forward;
-//  bool outer;
-  POLYAREA *np;
-//  POLYAREA *pa;
-//  PLINE *pline;
-//  VNODE *node;
-//  PolygonType *Polygon;
+  struct combine_layer layers[MAX_LAYER + 2];
+  struct combine_layer *cl;
+  struct combine_pool pool;
+  struct arena arena;
   LayerType *Layer = NULL;
-  poly_tree *root = NULL;
-  poly_tree *this_node;
+  bool all_layers = false;
+  int layers_n = 0;
+  int i, j;
+
+  if (argc > 0 && strcasecmp (argv[0], "AllLayers") == 0)
+    all_layers = true;
+  else if (argc > 0)
+    {
+      Message (_("ERROR: in PolyCombine, usage: %s\n"), polycombine_syntax);
+      return 1;
+    }
 
-  /* First pass to combine the forward and backward contours */
+  /* One pass to sort the selected polygons by layer */
+  memset (layers, 0, sizeof (layers));
+  memset (&arena, 0, sizeof (arena));
   VISIBLEPOLYGON_LOOP (PCB->Data);
   {
     if (!TEST_FLAG (SELECTEDFLAG, polygon))
@@ -320,47 +1136,71 @@ polycombine (int argc, char **argv, Coord x, Coord y)
     if (Layer == NULL)
       Layer = layer;
 
-    /* Only combine polygons on the same layer */
-    if (Layer != layer)
+    /* Unless doing them all, only combine polygons on the same layer */
+    if (!all_layers && Layer != layer)
       continue;
 
-    np = original_poly (polygon, &forward);
-
-    /* Build a poly_tree record */
-    this_node = calloc (1, sizeof (poly_tree));
-    this_node->polygon = polygon;
-    this_node->forward = forward;
-    this_node->polyarea = np;
-
-    /* Check where we should place the node in the tree */
-    root = insert_node_recursive (root, this_node);
-
-    //RemovePolygon (layer, polygon);
+    cl = &layers[layer - PCB->Data->Layer];
+    if (cl->layer == NULL)
+      {
+        cl->layer = layer;
+        layers_n++;
+      }
+    combine_layer_add (cl, polygon, &arena);
   }
   ENDALL_LOOP;
 
-  /* Now perform a traversal of the tree, computing a polygon */
-  res = compute_polygon_recursive (root, NULL);
+  if (layers_n == 0)
+    {
+      Message (_("PolyCombine: no polygons selected.\n"));
+      arena_free (&arena);
+      return 0;
+    }
+
+  /* Squeeze out the layers with nothing selected */
+  for (i = j = 0; i < MAX_LAYER + 2; i++)
+    if (layers[i].layer != NULL)
+      layers[j++] = layers[i];
+
+  /* One layer gets all the threads, otherwise each layer gets one */
+  if (layers_n == 1)
+    combine_layer_compute (&layers[0], true);
+  else
+    {
+      memset (&pool, 0, sizeof (pool));
+      pool.job = combine_layer_job;
+      pool.n = layers_n;
+      pool.layers = layers;
+      combine_run (&pool);
+    }
 
   SaveUndoSerialNumber ();
 
-  /* Second pass to remove the input polygons */
-  VISIBLEPOLYGON_LOOP (PCB->Data);
-  {
-    if (!TEST_FLAG (SELECTEDFLAG, polygon))
-      continue;
+  for (i = 0; i < layers_n; i++)
+    {
+      cl = &layers[i];
 
-    /* Only combine polygons on the same layer */
-    if (Layer != layer)
-      continue;
+      if (cl->merged)
+        Message (_("PolyCombine: %d groups of overlapping polygons on layer "
+                   "\"%s\" needed full booleans.\n"),
+                 cl->merged, cl->layer->Name);
 
-    RemovePolygon (layer, polygon);
-  }
-  ENDALL_LOOP;
+      /* Remove the input polygons */
+      for (j = 0; j < cl->nodes_n; j++)
+        RemovePolygon (cl->layer, cl->nodes[j]->polygon);
 
-  /* Now de-construct the resulting polygon into raw PCB polygons */
-  PolyToPolygonsOnLayer (PCB->Data, Layer, res,
-                         string_to_pcbflags ("clearpoly", NULL));
+      /* Now de-construct the resulting polygon into raw PCB polygons */
+      if (cl->result != NULL)
+        PolyToPolygonsOnLayer (PCB->Data, cl->layer, cl->result,
+                               string_to_pcbflags ("clearpoly", NULL));
+      poly_Free (&cl->result);
+      free (cl->nodes);
+    }
+
+  /* The tree nodes; their polygons were used up computing the result */
+  arena_free (&arena);
+
+  /* All layers are undone as one step */
   RestoreUndoSerialNumber ();
   IncrementUndoSerialNumber ();
   Draw ();
@@ -368,9 +1208,485 @@ polycombine (int argc, char **argv, Coord x, Coord y)
   return 0;
 }
 
+/*!
+ * \brief Reads a PCB layout file, such as pstoedit's pcbfill output, a
+ * token at a time.
+ */
+struct import_reader
+{
+  FILE *f;
+  const char *name;
+  int line;
+  bool quoted;          /* The token was a quoted string */
+  bool eof;             /* There are no more tokens */
+  char token[64];
+};
+
+/*!
+ * \brief Read the next token: a word or number (with any unit), a
+ * quoted string or character, or a single other character. At the end
+ * of the file, it is empty and eof is set.
+ */
+static const char *
+import_token (struct import_reader *r)
+{
+  int c, n = 0;
+
+  for (;;)
+    {
+      c = getc (r->f);
+      if (c == '\n')
+        r->line++;
+      else if (c == '#')
+        {
+          /* Comments run to the end of the line */
+          while ((c = getc (r->f)) != EOF && c != '\n')
+            ;
+          r->line++;
+        }
+      else if (!isspace (c))
+        break;
+    }
+
+  r->quoted = (c == '"' || c == '\'');
+  if (c == EOF)
+    r->eof = true;
+  else if (c == '\'')
+    {
+      /* Always one character, even in Symbol(''' 12) */
+      if ((c = getc (r->f)) != EOF)
+        r->token[n++] = c;
+      getc (r->f);
+    }
+  else if (c == '"')
+    {
+      while ((c = getc (r->f)) != EOF && c != '"')
+        if (n < sizeof (r->token) - 1)
+          r->token[n++] = c;
+    }
+  else if (isalnum (c) || c == '-' || c == '+' || c == '.' || c == '_')
+    {
+      do
+        {
+          if (n < sizeof (r->token) - 1)
+            r->token[n++] = c;
+        }
+      while ((c = getc (r->f)) != EOF
+             && (isalnum (c) || c == '-' || c == '+' || c == '.' || c == '_'));
+      ungetc (c, r->f);
+    }
+  else
+    r->token[n++] = c;
+
+  r->token[n] = '\0';
+  return r->token;
+}
+
+/*!
+ * \brief Read one point, after its opening bracket \p open, appending
+ * it to \p points.
+ *
+ * Points are [X Y] in the file's units (centimils unless given), or
+ * (X Y) in mils.
+ */
+static bool
+import_point (struct import_reader *r, char open, PointType **points,
+              Cardinal *point_n, Cardinal *point_max)
+{
+  const char *t;
+  const char *units = (open == '[') ? NULL : "mil";
+  bool rel;
+  Coord xy[2];
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      t = import_token (r);
+      if (r->eof)
+        return false;
+      /* An explicit unit wins over the bracket's */
+      xy[i] = GetValue (t, strpbrk (t, "abcdefghijklmnopqrstuvwxyz") ?
+                        NULL : units, &rel);
+    }
+  if (*import_token (r) != ((open == '[') ? ']' : ')'))
+    return false;
+
+  if (*point_n == *point_max)
+    {
+      *point_max = *point_max ? *point_max * 2 : 256;
+      *points = realloc (*points, *point_max * sizeof (PointType));
+    }
+  (*points)[*point_n].X = xy[0];
+  (*points)[*point_n].Y = xy[1];
+  (*point_n)++;
+  return true;
+}
+
+/*!
+ * \brief The points read so far of one polygon record.
+ */
+struct import_polygon
+{
+  PointType *points;
+  Cardinal point_n;
+  Cardinal point_max;
+  Cardinal *holes;      /* Where each hole starts in points */
+  Cardinal hole_n;
+  Cardinal hole_max;
+};
+
+/*!
+ * \brief Read the rest of a Polygon record, after its name: its flags,
+ * outer contour and any Hole blocks.
+ */
+static bool
+import_polygon (struct import_reader *r, struct import_polygon *ip)
+{
+  const char *t;
+  bool in_hole = false;
+
+  ip->point_n = 0;
+  ip->hole_n = 0;
+
+  /* Flags, which are not needed */
+  if (*import_token (r) != '(')
+    return false;
+  while (*(t = import_token (r)) != ')' || r->quoted)
+    if (r->eof)
+      return false;
+
+  if (*import_token (r) != '(')
+    return false;
+
+  for (;;)
+    {
+      t = import_token (r);
+      if (*t == '[' || *t == '(')
+        {
+          if (!import_point (r, *t, &ip->points, &ip->point_n, &ip->point_max))
+            return false;
+        }
+      else if (*t == ')' && in_hole)
+        in_hole = false;
+      else if (*t == ')')
+        return true;
+      else if (strcasecmp (t, "Hole") == 0 && !in_hole
+               && *import_token (r) == '(')
+        {
+          if (ip->hole_n == ip->hole_max)
+            {
+              ip->hole_max = ip->hole_max ? ip->hole_max * 2 : 16;
+              ip->holes = realloc (ip->holes, ip->hole_max * sizeof (Cardinal));
+            }
+          ip->holes[ip->hole_n++] = ip->point_n;
+          in_hole = true;
+        }
+      else
+        return false;
+    }
+}
+
+/*!
+ * \brief Find a layer by number, counting from 1, or by name.
+ */
+static LayerType *
+import_layer (const char *name)
+{
+  char *end;
+  long n;
+  int i;
+
+  n = strtol (name, &end, 10);
+  if (*end == '\0' && n >= 1 && n <= max_copper_layer + 2)
+    return &PCB->Data->Layer[n - 1];
+
+  for (i = 0; i < max_copper_layer + 2; i++)
+    if (PCB->Data->Layer[i].Name != NULL
+        && strcasecmp (PCB->Data->Layer[i].Name, name) == 0)
+      return &PCB->Data->Layer[i];
+
+  return NULL;
+}
+
+/*!
+ * \brief Read every polygon in file \p name into \p cl, moved by
+ * (dx, dy).
+ *
+ * On failure the nodes read so far are left in \p cl, still owning
+ * their polygons.
+ */
+static bool
+import_file (const char *name, Coord dx, Coord dy, struct combine_layer *cl,
+             struct arena *arena)
+{
+  struct import_reader r;
+  struct import_polygon ip;
+  POLYAREA *np;
+  bool forward;
+  bool ok = true;
+  const char *t;
+  Cardinal i;
+
+  memset (&r, 0, sizeof (r));
+  r.name = name;
+  r.line = 1;
+  if ((r.f = fopen (r.name, "r")) == NULL)
+    {
+      Message (_("ERROR: cannot read \"%s\".\n"), r.name);
+      return false;
+    }
+
+  /* Each polygon goes straight into the tree, never onto the board */
+  memset (&ip, 0, sizeof (ip));
+  for (;;)
+    {
+      t = import_token (&r);
+      if (r.eof)
+        break;
+      if (r.quoted || strcasecmp (t, "Polygon") != 0)
+        continue;
+      if (!import_polygon (&r, &ip))
+        {
+          Message (_("ERROR: %s:%d: bad polygon.\n"), r.name, r.line);
+          ok = false;
+          break;
+        }
+      for (i = 0; i < ip.point_n; i++)
+        {
+          ip.points[i].X += dx;
+          ip.points[i].Y += dy;
+        }
+      np = points_poly (ip.points, ip.point_n, ip.holes, ip.hole_n, &forward);
+      combine_layer_insert (cl, NULL, np, forward, arena);
+    }
+  fclose (r.f);
+  free (ip.points);
+  free (ip.holes);
+
+  return ok;
+}
+
+/*!
+ * \brief Free the polygons of nodes which were never computed.
+ */
+static void
+combine_layer_discard (struct combine_layer *cl)
+{
+  int i;
+
+  for (i = 0; i < cl->nodes_n; i++)
+    poly_Free (&cl->nodes[i]->polyarea);
+  free (cl->nodes);
+  cl->nodes = NULL;
+  cl->nodes_n = cl->nodes_max = 0;
+}
+
+static const char polyimport_syntax[] = "PolyImport(file, layer)";
+
+static int
+polyimport (int argc, char **argv, Coord x, Coord y)
+{
+  struct combine_layer cl;
+  struct arena arena;
+
+  if (argc != 2)
+    {
+      Message (_("ERROR: in PolyImport, usage: %s\n"), polyimport_syntax);
+      return 1;
+    }
+
+  memset (&cl, 0, sizeof (cl));
+  if ((cl.layer = import_layer (argv[1])) == NULL)
+    {
+      Message (_("ERROR: in PolyImport, no layer \"%s\".\n"), argv[1]);
+      return 1;
+    }
+
+  memset (&arena, 0, sizeof (arena));
+  if (!import_file (argv[0], 0, 0, &cl, &arena))
+    {
+      combine_layer_discard (&cl);
+      arena_free (&arena);
+      return 1;
+    }
+
+  combine_layer_compute (&cl, true);
+
+  if (cl.result != NULL)
+    PolyToPolygonsOnLayer (PCB->Data, cl.layer, cl.result,
+                           string_to_pcbflags ("clearpoly", NULL));
+  poly_Free (&cl.result);
+  IncrementUndoSerialNumber ();
+  Draw ();
+  Message (_("PolyImport: combined %d polygons from \"%s\", "
+             "%d groups of them overlapping.\n"),
+           cl.nodes_n, argv[0], cl.merged);
+
+  free (cl.nodes);
+  arena_free (&arena);
+
+  return 0;
+}
+
+/*!
+ * \brief Area covered by \p pa, holes taken away.
+ */
+static double
+poly_area (POLYAREA *pa)
+{
+  POLYAREA *p = pa;
+  PLINE *pl;
+  double area = 0;
+
+  if (pa == NULL)
+    return 0;
+  do
+    for (pl = p->contours; pl != NULL; pl = pl->next)
+      area += (pl->Flags.orient == PLF_DIR) ? fabs (pl->area) : -fabs (pl->area);
+  while ((p = p->f) != pa);
+
+  return area;
+}
+
+/*!
+ * \brief Read \p name tiled \p tiles times each way, \p pitch_x and
+ * \p pitch_y apart, into \p cl.
+ */
+static bool
+import_tiled (const char *name, int tiles, Coord pitch_x, Coord pitch_y,
+              struct combine_layer *cl, struct arena *arena)
+{
+  int i, j;
+
+  for (j = 0; j < tiles; j++)
+    for (i = 0; i < tiles; i++)
+      if (!import_file (name, i * pitch_x, j * pitch_y, cl, arena))
+        return false;
+  return true;
+}
+
+static const char polycombine_bench_syntax[] =
+  "PolyCombineBench(input, expected[, tiles[, tolerance]])";
+
+/*!
+ * \brief Combine the polygons of \p input, tiled N x N, and compare
+ * the result with the polygons of \p expected, tiled the same way.
+ *
+ * The result matches when the area where the two differ is at most
+ * \p tolerance times the expected area. Nothing on the board changes.
+ */
+static int
+polycombine_bench (int argc, char **argv, Coord x, Coord y)
+{
+  struct combine_layer input, expected;
+  struct arena arena;
+  Coord pitch_x = 0, pitch_y = 0;
+  POLYAREA **polys;
+  POLYAREA *want, *diff;
+  double start, read_time, want_area, diff_area, tolerance = 0.001;
+  int tiles = 1, i;
+  bool ok;
+
+  if (argc < 2)
+    {
+      Message (_("ERROR: in PolyCombineBench, usage: %s\n"),
+               polycombine_bench_syntax);
+      return 1;
+    }
+  if (argc > 2)
+    tiles = atoi (argv[2]);
+  if (argc > 3)
+    tolerance = strtod (argv[3], NULL);
+  if (tiles < 1 || tolerance < 0)
+    {
+      Message (_("ERROR: in PolyCombineBench, usage: %s\n"),
+               polycombine_bench_syntax);
+      return 1;
+    }
+
+  memset (&input, 0, sizeof (input));
+  memset (&expected, 0, sizeof (expected));
+  memset (&arena, 0, sizeof (arena));
+
+  /* The first tile gives the spacing, a tenth apart */
+  start = combine_now ();
+  ok = import_file (argv[0], 0, 0, &input, &arena);
+  if (ok && input.nodes_n > 0)
+    {
+      BoxType box = input.nodes[0]->box;
+
+      for (i = 1; i < input.nodes_n; i++)
+        {
+          MAKEMIN (box.X1, input.nodes[i]->box.X1);
+          MAKEMIN (box.Y1, input.nodes[i]->box.Y1);
+          MAKEMAX (box.X2, input.nodes[i]->box.X2);
+          MAKEMAX (box.Y2, input.nodes[i]->box.Y2);
+        }
+      pitch_x = (box.X2 - box.X1) * 11 / 10;
+      pitch_y = (box.Y2 - box.Y1) * 11 / 10;
+      /* The first tile is already in */
+      for (i = 1; ok && i < tiles * tiles; i++)
+        ok = import_file (argv[0], i % tiles * pitch_x, i / tiles * pitch_y,
+                          &input, &arena);
+    }
+  read_time = combine_now () - start;
+  if (ok)
+    ok = import_tiled (argv[1], tiles, pitch_x, pitch_y, &expected, &arena);
+  if (!ok)
+    {
+      combine_layer_discard (&input);
+      combine_layer_discard (&expected);
+      arena_free (&arena);
+      return 1;
+    }
+
+  combine_layer_compute (&input, true);
+
+  /* The expected polygons are final, they only need putting together */
+  polys = malloc (expected.nodes_n * sizeof (POLYAREA *));
+  for (i = 0; i < expected.nodes_n; i++)
+    {
+      polys[i] = expected.nodes[i]->polyarea;
+      expected.nodes[i]->polyarea = NULL;
+    }
+  want = unite_parallel (polys, expected.nodes_n);
+  free (polys);
+
+  want_area = poly_area (want);
+  diff = NULL;
+  if (input.result != NULL && want != NULL)
+    poly_Boolean (input.result, want, &diff, PBO_XOR);
+  else
+    poly_M_Copy0 (&diff, input.result != NULL ? input.result : want);
+  diff_area = fabs (poly_area (diff));
+  ok = diff_area <= tolerance * fabs (want_area);
+
+  Message (_("PolyCombineBench: %s, %dx%d tiles, %d polygons, "
+             "%d overlapping groups, read %.3f ms, tree %.3f ms, "
+             "booleans %.3f ms, area %.6g, differs by %.6g (%.3g%%): %s\n"),
+           argv[0], tiles, tiles, input.nodes_n, input.merged,
+           read_time * 1e3, input.tree_time * 1e3, input.boolean_time * 1e3,
+           want_area, diff_area,
+           want_area != 0 ? 100 * diff_area / fabs (want_area) : 0.0,
+           ok ? "PASS" : "FAIL");
+
+  poly_Free (&diff);
+  poly_Free (&want);
+  poly_Free (&input.result);
+  free (input.nodes);
+  free (expected.nodes);
+  arena_free (&arena);
+
+  return ok ? 0 : 1;
+}
+
 static HID_Action polycombine_action_list[] = {
   {"PolyCombine", "???", polycombine,
-   NULL, NULL}
+   NULL, polycombine_syntax},
+  {"PolyImport", NULL, polyimport,
+   NULL, polyimport_syntax},
+  {"PolyCombineBench", NULL, polycombine_bench,
+   NULL, polycombine_bench_syntax}
 };
 
 REGISTER_ACTIONS (polycombine_action_list)